@@ -0,0 +1,110 @@
+/* */
+
+#include "allocator.h"
+#include <stdexcept>
+#include <cstring>
+#include <sys/socket.h>
+#include <netdb.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <errno.h>
+#include <10util/util.h>
+
+using namespace std;
+
+/** True if something accepts TCP connections on hostname:port within 200ms */
+bool mongoDeploy::portInUse (string hostname, unsigned port) {
+	addrinfo hints, *addrs;
+	memset (&hints, 0, sizeof hints);
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	if (getaddrinfo (hostname.c_str(), to_string (port) .c_str(), &hints, &addrs) != 0) return false;
+	bool inUse = false;
+	for (addrinfo* a = addrs; a && ! inUse; a = a->ai_next) {
+		int fd = socket (a->ai_family, a->ai_socktype, a->ai_protocol);
+		if (fd < 0) continue;
+		fcntl (fd, F_SETFL, O_NONBLOCK);
+		if (connect (fd, a->ai_addr, a->ai_addrlen) == 0) inUse = true;
+		else if (errno == EINPROGRESS) {
+			pollfd p = {fd, POLLOUT, 0};
+			int err = 0;
+			socklen_t len = sizeof err;
+			if (poll (&p, 1, 200) == 1 && getsockopt (fd, SOL_SOCKET, SO_ERROR, &err, &len) == 0 && err == 0) inUse = true;
+		}
+		close (fd);
+	}
+	freeaddrinfo (addrs);
+	return inUse;
+}
+
+/** Unused port on host, recycled ports first. Raise if range is exhausted */
+unsigned mongoDeploy::Allocator::allocPort (string hostname) {
+	while (true) {
+		unsigned port;
+		{
+			boost::mutex::scoped_lock lock (mutex);
+			HostState& h = hosts[hostname];
+			if (! h.freePorts.empty()) {
+				port = h.freePorts.front();
+				h.freePorts.pop_front();
+			} else {
+				while (h.next < portCount && h.used.count (portBase + h.next)) h.next ++;
+				if (h.next >= portCount) throw runtime_error ("no free ports left on " + hostname);
+				port = portBase + h.next ++;
+			}
+			h.used.insert (port);
+		}
+		// probe outside lock. A port found busy stays marked used so it is not handed out again
+		if (! probePorts || ! portInUse (hostname, port)) return port;
+	}
+}
+
+/** Released dbpath on host if any, else name placed under next data root */
+string mongoDeploy::Allocator::allocDbPath (string hostname, string name) {
+	boost::mutex::scoped_lock lock (mutex);
+	HostState& h = hosts[hostname];
+	if (! h.freeDbPaths.empty()) {
+		string path = h.freeDbPaths.front();
+		h.freeDbPaths.pop_front();
+		return path;
+	}
+	if (dataRoots.empty()) return name;
+	return dataRoots [h.nextRoot ++ % dataRoots.size()] + "/" + name;
+}
+
+/** Mark port as used, eg. by a reattached process */
+void mongoDeploy::Allocator::reservePort (string hostname, unsigned port) {
+	boost::mutex::scoped_lock lock (mutex);
+	hosts[hostname].used.insert (port);
+}
+
+void mongoDeploy::Allocator::releasePort (string hostname, unsigned port) {
+	boost::mutex::scoped_lock lock (mutex);
+	HostState& h = hosts[hostname];
+	if (h.used.erase (port)) h.freePorts.push_back (port);
+}
+
+void mongoDeploy::Allocator::releaseDbPath (string hostname, string dbPath) {
+	boost::mutex::scoped_lock lock (mutex);
+	hosts[hostname].freeDbPaths.push_back (dbPath);
+}
+
+static void noCleanup (mongoDeploy::Allocator*) {}  // allocator is owned by its creator, not the thread
+
+static boost::thread_specific_ptr<mongoDeploy::Allocator> currentAllocator (noCleanup);
+
+/** Allocator used by startMongoD and startMongoS: the one in scope on this thread, else a global one */
+mongoDeploy::Allocator& mongoDeploy::allocator () {
+	static Allocator a;
+	return currentAllocator.get() ? *currentAllocator : a;
+}
+
+mongoDeploy::AllocatorScope::AllocatorScope (Allocator& a) : prev(currentAllocator.get()) {
+	currentAllocator.reset (&a);}
+
+mongoDeploy::AllocatorScope::~AllocatorScope () {
+	currentAllocator.reset (prev);}
+
+mongoDeploy::Allocator* mongoDeploy::scopedAllocator () {
+	return currentAllocator.get();}
@@ -0,0 +1,66 @@
+/* Ports and data directories for new mongo processes */
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <map>
+#include <set>
+#include <deque>
+#include <boost/thread.hpp>
+#include <boost/noncopyable.hpp>
+
+namespace mongoDeploy {
+
+/** Hands out ports from a per-host range and places dbpaths across data roots. Ports and dbpaths released on stop are reused. Thread-safe */
+class Allocator {
+public:
+	unsigned portBase;  // first port on each host (27101 by default)
+	unsigned portCount;  // size of port range on each host (1000 by default)
+	bool probePorts;  // skip ports something is already listening on (true by default)
+	/** Directories dbpaths are spread across round-robin per host, eg. one per disk. Empty (default) means current directory */
+	std::vector<std::string> dataRoots;
+	/** Prepended to generated dbpath and replica set names, eg. to tell apart clusters of several driver processes. Empty by default */
+	std::string namePrefix;
+	Allocator () : portBase(27101), portCount(1000), probePorts(true) {}
+	/** Put dbpaths in memory for throwaway clusters */
+	void useTmpfs (std::string root = "/dev/shm/mongoDeploy") {dataRoots = std::vector<std::string> (1, root);}
+	/** Unused port on host. Raise if range is exhausted */
+	unsigned allocPort (std::string hostname);
+	/** Released dbpath on host if any, else name placed under next data root */
+	std::string allocDbPath (std::string hostname, std::string name);
+	/** Mark port as used, eg. by a reattached process */
+	void reservePort (std::string hostname, unsigned port);
+	void releasePort (std::string hostname, unsigned port);
+	void releaseDbPath (std::string hostname, std::string dbPath);
+private:
+	struct HostState {
+		unsigned next;  // offset into port range
+		std::set<unsigned> used;
+		std::deque<unsigned> freePorts;
+		std::deque<std::string> freeDbPaths;
+		unsigned nextRoot;
+		HostState () : next(0), nextRoot(0) {}
+	};
+	std::map<std::string, HostState> hosts;
+	boost::mutex mutex;
+};
+
+/** Allocator used by startMongoD and startMongoS: the one in scope on this thread, else a global one */
+Allocator& allocator ();
+
+/** While in scope, allocator() is the given allocator on this thread and on threads that parallel(), executor() and async() run for it, so a whole cluster can be built from its own ports, dbpaths and names */
+class AllocatorScope : boost::noncopyable {
+	Allocator* prev;
+public:
+	AllocatorScope (Allocator&);
+	~AllocatorScope ();
+};
+
+/** Allocator in scope on this thread, 0 if none. For carrying the scope over to another thread */
+Allocator* scopedAllocator ();
+
+/** True if something accepts TCP connections on hostname:port */
+bool portInUse (std::string hostname, unsigned port);
+
+}
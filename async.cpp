@@ -0,0 +1,44 @@
+/* */
+
+#include "async.h"
+
+using namespace std;
+
+static mongoDeploy::MongoD startWaitMongoD (remote::Host host, program::Options opts) {
+	mongoDeploy::MongoD p = mongoDeploy::startMongoD (host, opts);
+	mongoDeploy::waitConnect (p);
+	return p;
+}
+
+boost::shared_future<mongoDeploy::MongoD> mongoDeploy::startMongoDAsync (remote::Host host, program::Options opts, boost::function1< void, boost::shared_future<MongoD> > onDone) {
+	return async<MongoD> (boost::bind (startWaitMongoD, host, opts), onDone);
+}
+
+static mongoDeploy::Connection waitConnectTo (string hostPort, mongoDeploy::Backoff backoff) {
+	return mongoDeploy::waitConnect (hostPort, backoff);}
+
+boost::shared_future<mongoDeploy::Connection> mongoDeploy::waitConnectAsync (string hostPort, Backoff backoff, boost::function1< void, boost::shared_future<Connection> > onDone) {
+	return async<Connection> (boost::bind (waitConnectTo, hostPort, backoff), onDone);
+}
+
+boost::shared_future<mongoDeploy::ReplicaSet> mongoDeploy::startReplicaSetAsync (vector<remote::Host> hosts, vector<RsMemberSpec> specs, mongo::BSONObj rsSettings, boost::function1< void, boost::shared_future<ReplicaSet> > onDone) {
+	return async<ReplicaSet> (boost::bind (startReplicaSet, hosts, specs, rsSettings.getOwned()), onDone);
+}
+
+boost::shared_future<mongoDeploy::ConfigSet> mongoDeploy::startConfigSetAsync (vector<remote::Host> hosts, program::Options opts, boost::function1< void, boost::shared_future<ConfigSet> > onDone) {
+	return async<ConfigSet> (boost::bind (startConfigSet, hosts, opts), onDone);
+}
+
+boost::shared_future<mongoDeploy::ShardSet> mongoDeploy::startShardSetAsync (vector<remote::Host> cfgHosts, vector<remote::Host> routerHosts, program::Options cfgOpts, program::Options routerOpts, boost::function1< void, boost::shared_future<ShardSet> > onDone) {
+	return async<ShardSet> (boost::bind (startShardSet, cfgHosts, routerHosts, cfgOpts, routerOpts), onDone);
+}
+
+static mongoDeploy::ShardSet addStartShardTo (mongoDeploy::ShardSet s, vector<remote::Host> hosts, vector<mongoDeploy::RsMemberSpec> specs, mongo::BSONObj rsSettings) {
+	s.addStartShard (hosts, specs, rsSettings);
+	return s;
+}
+
+/** Async ShardSet::addStartShard on a copy of shard set. Future holds the shard set with the new shard added */
+boost::shared_future<mongoDeploy::ShardSet> mongoDeploy::addStartShardAsync (ShardSet s, vector<remote::Host> hosts, vector<RsMemberSpec> specs, mongo::BSONObj rsSettings, boost::function1< void, boost::shared_future<ShardSet> > onDone) {
+	return async<ShardSet> (boost::bind (addStartShardTo, s, hosts, specs, rsSettings.getOwned()), onDone);
+}
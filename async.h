@@ -0,0 +1,51 @@
+/* Future-returning variants of the deployment API, each run on its own thread */
+
+#pragma once
+
+#include "mongoDeploy.h"
+#include "allocator.h"
+#include <boost/thread/future.hpp>
+
+namespace mongoDeploy {
+
+namespace detail {
+
+template <class T> void runTask (boost::shared_ptr< boost::packaged_task<T> > task, boost::shared_future<T> result, boost::function1< void, boost::shared_future<T> > onDone, Allocator* allocator) {
+	if (allocator) {
+		AllocatorScope scope (*allocator);
+		runTask (task, result, onDone, (Allocator*) 0);
+		return;
+	}
+	(*task)();  // result or exception is stored in future
+	if (onDone) onDone (result);
+}
+
+}
+
+/** Run action on a new thread in the caller's allocator scope. Returned future holds its result or exception. onDone, if given, is called on that thread with the ready future. Not on executor(): async calls block for whole deployments and may nest or wait on deploy, which would starve its fixed pool, so they are not limited in number */
+template <class T> boost::shared_future<T> async (boost::function0<T> action, boost::function1< void, boost::shared_future<T> > onDone = 0) {
+	boost::shared_ptr< boost::packaged_task<T> > task (new boost::packaged_task<T> (action));
+	boost::shared_future<T> result (task->get_future());
+	boost::thread (boost::bind (detail::runTask<T>, task, result, onDone, scopedAllocator())) .detach();
+	return result;
+}
+
+/** Async startMongoD. Future is ready once mongod accepts connections */
+boost::shared_future<MongoD> startMongoDAsync (remote::Host, program::Options = program::Options(), boost::function1< void, boost::shared_future<MongoD> > onDone = 0);
+
+/** Async waitConnect */
+boost::shared_future<Connection> waitConnectAsync (std::string hostPort, Backoff = defaultBackoff, boost::function1< void, boost::shared_future<Connection> > onDone = 0);
+
+/** Async startReplicaSet */
+boost::shared_future<ReplicaSet> startReplicaSetAsync (std::vector<remote::Host>, std::vector<RsMemberSpec>, mongo::BSONObj rsSettings = mongo::BSONObj(), boost::function1< void, boost::shared_future<ReplicaSet> > onDone = 0);
+
+/** Async startConfigSet */
+boost::shared_future<ConfigSet> startConfigSetAsync (std::vector<remote::Host>, program::Options = program::Options(), boost::function1< void, boost::shared_future<ConfigSet> > onDone = 0);
+
+/** Async startShardSet */
+boost::shared_future<ShardSet> startShardSetAsync (std::vector<remote::Host> cfgHosts, std::vector<remote::Host> routerHosts, program::Options cfgOpts = program::Options(), program::Options routerOpts = program::Options(), boost::function1< void, boost::shared_future<ShardSet> > onDone = 0);
+
+/** Async ShardSet::addStartShard on a copy of shard set. Future holds the shard set with the new shard added */
+boost::shared_future<ShardSet> addStartShardAsync (ShardSet, std::vector<remote::Host>, std::vector<RsMemberSpec>, mongo::BSONObj rsSettings = mongo::BSONObj(), boost::function1< void, boost::shared_future<ShardSet> > onDone = 0);
+
+}
@@ -0,0 +1,177 @@
+/* */
+
+#include "balance.h"
+#include "parallel.h"
+#include "trace.h"
+#include <set>
+
+using namespace std;
+
+/** Estimated bytes and docs of chunks of one shard, from dataSize on its primary */
+static Unit sizeChunks (mongoDeploy::ReplicaSet rs, string ns, mongo::BSONObj keyPattern, vector<mongoDeploy::Chunk*> chunks) {
+	mongoDeploy::Connection c = rs.primary();
+	for (unsigned i = 0; i < chunks.size(); i++) {
+		mongo::BSONObj info;
+		if (! c->runCommand ("admin", BSON ("dataSize" << ns << "keyPattern" << keyPattern << "min" << chunks[i]->min << "max" << chunks[i]->max << "estimate" << true), info)) continue;
+		chunks[i]->bytes = info["size"].numberDouble();
+		chunks[i]->docs = info["numObjects"].numberLong();
+	}
+	return unit;
+}
+
+static bool largerChunk (const mongoDeploy::Chunk& a, const mongoDeploy::Chunk& b) {return a.bytes > b.bytes;}
+
+/** Bytes of fullest shard over mean bytes per shard */
+static double imbalance (vector<mongoDeploy::ShardLoad>& shards) {
+	double total = 0, most = 0;
+	for (unsigned i = 0; i < shards.size(); i++) {total += shards[i].bytes; most = max (most, shards[i].bytes);}
+	return total > 0 ? most * shards.size() / total : 1;
+}
+
+mongoDeploy::Distribution mongoDeploy::distribution (ShardSet& s, string ns, double hotFactor) {
+	Span span ("distribution", ns);
+	Distribution d (ns);
+	Connection c = s.router();
+	mongo::BSONObj coll = c->findOne ("config.collections", BSON ("_id" << ns));
+	if (coll.isEmpty()) throw runtime_error (ns + " is not sharded");
+	mongo::BSONObj keyPattern = coll.getObjectField ("key") .getOwned();
+	auto_ptr<mongo::DBClientCursor> cursor = c->query ("config.chunks", mongo::Query (BSON ("ns" << ns)) .sort ("min"));
+	while (cursor->more()) {
+		mongo::BSONObj chunk = cursor->next();
+		d.chunks.push_back (Chunk (chunk.getObjectField ("min") .getOwned(), chunk.getObjectField ("max") .getOwned(), chunk.getStringField ("shard")));
+	}
+	map<string,unsigned> index;
+	for (unsigned i = 0; i < s.shards.size(); i++) {
+		index[s.shards[i].name()] = i;
+		d.shards.push_back (ShardLoad (s.shards[i].name()));
+	}
+	mongo::BSONObj info;
+	string database = ns.substr (0, ns.find ('.'));
+	if (c->runCommand (database, BSON ("collStats" << ns.substr (ns.find ('.') + 1)), info)) {
+		mongo::BSONObj perShard = info.getObjectField ("shards");
+		for (unsigned i = 0; i < d.shards.size(); i++) {
+			mongo::BSONObj stats = perShard.getObjectField (d.shards[i].shard.c_str());
+			d.shards[i].bytes = stats["size"].numberDouble();
+			d.shards[i].docs = stats["count"].numberLong();
+		}
+	}
+	// Size chunks on all shards concurrently
+	vector< vector<Chunk*> > byShard (s.shards.size());
+	for (unsigned i = 0; i < d.chunks.size(); i++) {
+		if (! index.count (d.chunks[i].shard)) continue;
+		unsigned j = index[d.chunks[i].shard];
+		byShard[j].push_back (&d.chunks[i]);
+		d.shards[j].chunks ++;
+	}
+	vector< boost::function0<Unit> > sizings;
+	for (unsigned j = 0; j < byShard.size(); j++)
+		if (! byShard[j].empty()) sizings.push_back (boost::bind (sizeChunks, s.shards[j], ns, keyPattern, byShard[j]));
+	parallel (sizings);
+	for (unsigned j = 0; j < d.shards.size(); j++)
+		if (d.shards[j].bytes == 0)  // collStats unavailable, fall back on chunk estimates
+			for (unsigned i = 0; i < byShard[j].size(); i++) d.shards[j].bytes += byShard[j][i]->bytes;
+	d.imbalance = imbalance (d.shards);
+	double total = 0;
+	for (unsigned i = 0; i < d.chunks.size(); i++) total += d.chunks[i].bytes;
+	double mean = d.chunks.empty() ? 0 : total / d.chunks.size();
+	for (unsigned i = 0; i < d.chunks.size(); i++) if (mean > 0 && d.chunks[i].bytes > hotFactor * mean) d.hotChunks.push_back (d.chunks[i]);
+	sort (d.hotChunks.begin(), d.hotChunks.end(), largerChunk);
+	return d;
+}
+
+/** A planned chunk move */
+struct Move {
+	mongoDeploy::Chunk chunk;
+	string to;
+	Move (mongoDeploy::Chunk chunk, string to) : chunk(chunk), to(to) {}
+};
+
+/** Greedy plan: repeatedly move the largest chunk of the fullest shard that narrows its gap to the emptiest shard */
+static vector<Move> plan (mongoDeploy::Distribution d, mongoDeploy::RebalanceOptions opts) {
+	vector<Move> moves;
+	vector<mongoDeploy::Chunk> chunks = d.chunks;
+	sort (chunks.begin(), chunks.end(), largerChunk);
+	vector<mongoDeploy::ShardLoad> shards = d.shards;
+	set<unsigned> moved;
+	while (shards.size() > 1 && imbalance (shards) > opts.tolerance && (opts.maxMoves == 0 || moves.size() < opts.maxMoves)) {
+		unsigned full = 0, empty = 0;
+		for (unsigned i = 1; i < shards.size(); i++) {
+			if (shards[i].bytes > shards[full].bytes) full = i;
+			if (shards[i].bytes < shards[empty].bytes) empty = i;
+		}
+		double gap = shards[full].bytes - shards[empty].bytes;
+		unsigned pick = chunks.size();
+		for (unsigned i = 0; i < chunks.size() && pick == chunks.size(); i++)
+			if (! moved.count (i) && chunks[i].shard == shards[full].shard && chunks[i].bytes > 0 && chunks[i].bytes < gap) pick = i;
+		if (pick == chunks.size()) break;  // no chunk small enough to help
+		moved.insert (pick);
+		moves.push_back (Move (chunks[pick], shards[empty].shard));
+		shards[full].bytes -= chunks[pick].bytes;
+		shards[empty].bytes += chunks[pick].bytes;
+	}
+	return moves;
+}
+
+/** Moves waiting to run, and shards taking part in a running move */
+struct MoveQueue {
+	vector<Move> pending;
+	set<string> busy;
+	boost::mutex mutex;
+	boost::condition_variable changed;
+	mongoDeploy::RebalanceResult* result;
+};
+
+/** Run moves whose shards are both idle until none are left */
+static void mover (mongoDeploy::ShardSet* s, string ns, MoveQueue* q) {
+	while (true) {
+		boost::unique_lock<boost::mutex> lock (q->mutex);
+		unsigned i;
+		while (true) {
+			if (q->pending.empty()) return;
+			for (i = 0; i < q->pending.size(); i++)
+				if (! q->busy.count (q->pending[i].chunk.shard) && ! q->busy.count (q->pending[i].to)) break;
+			if (i < q->pending.size()) break;
+			q->changed.wait (lock);
+		}
+		Move m = q->pending[i];
+		q->pending.erase (q->pending.begin() + i);
+		q->busy.insert (m.chunk.shard);
+		q->busy.insert (m.to);
+		lock.unlock();
+		mongo::BSONObj cmd = BSON ("moveChunk" << ns << "find" << m.chunk.min << "to" << m.to);
+		mongo::BSONObj info;
+		bool ok = false;
+		{
+			mongoDeploy::Span span ("moveChunk", mongoDeploy::spanning() ? cmd.toString() : "");
+			try {ok = s->router() ->runCommand ("admin", cmd, info);}
+			catch (exception& e) {info = BSON ("errmsg" << e.what());}
+			if (mongoDeploy::spanning()) span.outcome (info.toString());
+		}
+		lock.lock();
+		q->busy.erase (m.chunk.shard);
+		q->busy.erase (m.to);
+		if (ok) {q->result->moved ++; q->result->bytesMoved += m.chunk.bytes;}
+		else q->result->failed ++;
+		q->changed.notify_all();
+	}
+}
+
+mongoDeploy::RebalanceResult mongoDeploy::rebalance (ShardSet& s, string ns, RebalanceOptions opts) {
+	RebalanceResult result (ns);
+	boost::posix_time::ptime start = now();
+	Distribution before = distribution (s, ns);
+	result.imbalanceBefore = before.imbalance;
+	MoveQueue q;
+	q.pending = plan (before, opts);
+	q.result = &result;
+	result.planned = q.pending.size();
+	if (opts.stopBalancer) setBalancerStopped (s.router(), true);
+	boost::thread_group movers;
+	for (unsigned i = 0; i < max (1u, opts.concurrency) && i < q.pending.size(); i++)
+		movers.create_thread (boost::bind (mover, &s, ns, &q));
+	movers.join_all();
+	if (opts.stopBalancer) setBalancerStopped (s.router(), false);
+	result.millis = (now() - start) .total_milliseconds();
+	result.imbalanceAfter = distribution (s, ns) .imbalance;
+	return result;
+}
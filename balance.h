@@ -0,0 +1,75 @@
+/* Inspect how a sharded collection is spread over shards and even it out with targeted chunk moves */
+
+#pragma once
+
+#include "mongoDeploy.h"
+
+namespace mongoDeploy {
+
+/** A chunk of a sharded collection, per config.chunks */
+struct Chunk {
+	mongo::BSONObj min;
+	mongo::BSONObj max;
+	std::string shard;
+	double bytes;  // estimated by dataSize on the shard's primary
+	long long docs;
+	Chunk (mongo::BSONObj min, mongo::BSONObj max, std::string shard) : min(min), max(max), shard(shard), bytes(0), docs(0) {}
+};
+
+/** A shard's share of a sharded collection */
+struct ShardLoad {
+	std::string shard;
+	unsigned chunks;
+	double bytes;  // collStats size of the collection on the shard
+	long long docs;
+	ShardLoad (std::string shard) : shard(shard), chunks(0), bytes(0), docs(0) {}
+};
+
+/** Where a sharded collection's data lives */
+struct Distribution {
+	std::string ns;
+	std::vector<Chunk> chunks;  // in shard key order
+	std::vector<ShardLoad> shards;  // every shard of the shard set, even empty ones
+	double imbalance;  // bytes of fullest shard over mean bytes per shard. 1 is perfectly even
+	std::vector<Chunk> hotChunks;  // chunks over hotFactor times the mean chunk size, largest first
+	Distribution (std::string ns) : ns(ns), imbalance(1) {}
+};
+
+/** Read chunks of collection ns from config.chunks and its per-shard stats through a router, then estimate each chunk's size on its shard. Chunks over hotFactor times the mean chunk size are reported as hot */
+Distribution distribution (ShardSet&, std::string ns, double hotFactor = 2);
+
+/** How rebalance moves chunks */
+struct RebalanceOptions {
+	unsigned concurrency;  // moveChunks in flight at once (2 by default). A shard takes part in at most one at a time
+	double tolerance;  // stop once imbalance is at most this (1.1 by default)
+	unsigned maxMoves;  // 0 (default) means no limit
+	bool stopBalancer;  // pause the built-in balancer while moving (true by default)
+	RebalanceOptions (unsigned concurrency = 2, double tolerance = 1.1, unsigned maxMoves = 0, bool stopBalancer = true) : concurrency(concurrency), tolerance(tolerance), maxMoves(maxMoves), stopBalancer(stopBalancer) {}
+};
+
+/** Outcome of rebalance */
+struct RebalanceResult {
+	std::string ns;
+	unsigned planned;
+	unsigned moved;
+	unsigned failed;
+	double bytesMoved;  // estimated sizes of moved chunks
+	unsigned millis;
+	double imbalanceBefore;
+	double imbalanceAfter;
+	RebalanceResult (std::string ns) : ns(ns), planned(0), moved(0), failed(0), bytesMoved(0), millis(0), imbalanceBefore(1), imbalanceAfter(1) {}
+};
+
+/** Plan chunk moves from fullest to emptiest shard by estimated bytes, largest chunk that narrows the gap first, until imbalance is within opts.tolerance. Then run the plan with opts.concurrency moveChunks in flight, never two on the same shard */
+RebalanceResult rebalance (ShardSet&, std::string ns, RebalanceOptions opts = RebalanceOptions());
+
+}
+
+inline std::ostream& operator<< (std::ostream& out, const mongoDeploy::Distribution& x) {
+	out << "Distribution " << x.ns << " " << x.chunks.size() << " chunks, imbalance " << x.imbalance << ", " << x.hotChunks.size() << " hot";
+	for (unsigned i = 0; i < x.shards.size(); i++) out << " " << x.shards[i].shard << ":" << x.shards[i].chunks << "/" << x.shards[i].bytes / (1 << 20) << "MB";
+	return out;}
+
+inline std::ostream& operator<< (std::ostream& out, const mongoDeploy::RebalanceResult& x) {
+	out << "RebalanceResult " << x.ns << " " << x.moved << "/" << x.planned << " chunks moved (" << x.failed << " failed), " << x.bytesMoved / (1 << 20) << "MB in " << x.millis << "ms, imbalance " << x.imbalanceBefore << " -> " << x.imbalanceAfter;
+	return out;}
@@ -0,0 +1,99 @@
+/* */
+
+#include "connectionPool.h"
+#include "mongoDeploy.h"
+#include <boost/bind.hpp>
+
+using namespace std;
+
+/** Ping connection, false if it fails */
+static bool healthy (mongo::DBClientConnection* c) {
+	if (c->isFailed()) return false;
+	try {
+		mongo::BSONObj info;
+		return c->runCommand ("admin", BSON ("ping" << 1), info);
+	} catch (exception& e) {
+		return false;
+	}
+}
+
+mongoDeploy::ConnectionPool::~ConnectionPool () {
+	for (map< string, list<Idle> >::iterator h = idle.begin(); h != idle.end(); ++h)
+		for (list<Idle>::iterator i = h->second.begin(); i != h->second.end(); ++i) delete i->conn;
+}
+
+/** Healthy idle connection to hostPort if any, else a new one. Raise connect error */
+mongoDeploy::Connection mongoDeploy::ConnectionPool::get (string hostPort) {
+	evictIdle();
+	while (true) {
+		Idle cand (0, mongoDeploy::now());
+		{
+			boost::mutex::scoped_lock lock (mutex);
+			list<Idle>& l = idle[hostPort];
+			if (l.empty()) break;
+			cand = l.front();
+			l.pop_front();
+		}
+		// ping outside lock. Recently used connections are trusted
+		if ((mongoDeploy::now() - cand.since) .total_milliseconds() < checkAfterMillis ? !cand.conn->isFailed() : healthy (cand.conn))
+			return Connection (cand.conn, boost::bind (&ConnectionPool::release, this, hostPort, _1));
+		delete cand.conn;
+	}
+	mongo::DBClientConnection* c = new mongo::DBClientConnection;
+	try {
+		c->connect (hostPort);
+	} catch (...) {
+		delete c;
+		throw;
+	}
+	return Connection (c, boost::bind (&ConnectionPool::release, this, hostPort, _1));
+}
+
+void mongoDeploy::ConnectionPool::release (string hostPort, mongo::DBClientConnection* conn) {
+	if (! conn->isFailed()) {
+		boost::mutex::scoped_lock lock (mutex);
+		list<Idle>& l = idle[hostPort];
+		if (l.size() < maxIdlePerHost) {l.push_front (Idle (conn, mongoDeploy::now())); return;}
+	}
+	delete conn;
+}
+
+/** Close idle connections to hostPort, eg. after its process was stopped */
+void mongoDeploy::ConnectionPool::clear (string hostPort) {
+	list<Idle> l;
+	{
+		boost::mutex::scoped_lock lock (mutex);
+		l.swap (idle[hostPort]);
+	}
+	for (list<Idle>::iterator i = l.begin(); i != l.end(); ++i) delete i->conn;
+}
+
+/** Close idle connections that have been idle longer than maxIdleMillis. Most recently released are at the front of each list */
+void mongoDeploy::ConnectionPool::evictIdle () {
+	list<Idle> expired;
+	boost::posix_time::ptime t = mongoDeploy::now();
+	{
+		boost::mutex::scoped_lock lock (mutex);
+		for (map< string, list<Idle> >::iterator h = idle.begin(); h != idle.end(); ++h) {
+			list<Idle>& l = h->second;
+			list<Idle>::iterator i = l.begin();
+			while (i != l.end() && (t - i->since) .total_milliseconds() < maxIdleMillis) ++i;
+			expired.splice (expired.end(), l, i, l.end());
+		}
+	}
+	for (list<Idle>::iterator i = expired.begin(); i != expired.end(); ++i) delete i->conn;
+}
+
+/** Number of idle connections in pool */
+unsigned mongoDeploy::ConnectionPool::idleCount () {
+	boost::mutex::scoped_lock lock (mutex);
+	unsigned n = 0;
+	for (map< string, list<Idle> >::iterator h = idle.begin(); h != idle.end(); ++h) n += h->second.size();
+	return n;
+}
+
+/** Pool shared by waitConnect and all admin commands of this library. Never destroyed so connections released during static destruction are safe */
+mongoDeploy::ConnectionPool& mongoDeploy::connectionPool () {
+	static ConnectionPool* pool = new ConnectionPool();
+	return *pool;
+}
@@ -0,0 +1,47 @@
+/* Pool of reusable connections to mongo processes, shared by the deployment API */
+
+#pragma once
+
+#include <string>
+#include <map>
+#include <list>
+#include <mongo/client/dbclient.h>
+#include <boost/thread.hpp>
+#include <boost/date_time/posix_time/posix_time.hpp>
+
+namespace mongoDeploy {
+
+typedef boost::shared_ptr<mongo::DBClientConnection> Connection;
+
+/** Idle connections keyed by host:port. A connection handed out returns to the pool when its last copy is released. Thread-safe */
+class ConnectionPool {
+public:
+	unsigned maxIdleMillis;  // idle connections older than this are closed (5 mins by default)
+	unsigned checkAfterMillis;  // idle connections older than this are pinged before reuse (10 secs by default)
+	unsigned maxIdlePerHost;  // extra connections released beyond this are closed (16 by default)
+	ConnectionPool (unsigned maxIdleMillis = 300000, unsigned checkAfterMillis = 10000, unsigned maxIdlePerHost = 16) :
+		maxIdleMillis(maxIdleMillis), checkAfterMillis(checkAfterMillis), maxIdlePerHost(maxIdlePerHost) {}
+	~ConnectionPool ();
+	/** Healthy idle connection to hostPort if any, else a new one. Raise connect error */
+	Connection get (std::string hostPort);
+	/** Close idle connections to hostPort, eg. after its process was stopped */
+	void clear (std::string hostPort);
+	/** Close idle connections that have been idle longer than maxIdleMillis */
+	void evictIdle ();
+	/** Number of idle connections in pool */
+	unsigned idleCount ();
+private:
+	struct Idle {
+		mongo::DBClientConnection* conn;
+		boost::posix_time::ptime since;
+		Idle (mongo::DBClientConnection* conn, boost::posix_time::ptime since) : conn(conn), since(since) {}
+	};
+	std::map< std::string, std::list<Idle> > idle;
+	boost::mutex mutex;
+	void release (std::string hostPort, mongo::DBClientConnection* conn);
+};
+
+/** Pool shared by waitConnect and all admin commands of this library */
+ConnectionPool& connectionPool ();
+
+}
@@ -0,0 +1,248 @@
+/* */
+
+#include "deploy.h"
+#include "executor.h"
+#include "routers.h"
+#include "trace.h"
+#include "placement.h"
+#include <mongo/db/json.h>
+
+using namespace std;
+
+/** Options object (eg. {oplogSize: 200, dur: true}) as program options */
+program::Options mongoDeploy::toOptions (mongo::BSONObj obj) {
+	program::Options opts;
+	mongo::BSONObjIterator i (obj);
+	while (i.more()) {
+		mongo::BSONElement e = i.next();
+		if (e.type() == mongo::Bool) {if (e.boolean()) opts.push_back (make_pair (string (e.fieldName()), string ("")));}
+		else if (e.type() == mongo::String) opts.push_back (make_pair (string (e.fieldName()), e.String()));
+		else opts.push_back (make_pair (string (e.fieldName()), e.toString (false)));
+	}
+	return opts;
+}
+
+static vector<remote::Host> hostsOf (mongo::BSONObj obj) {
+	vector<remote::Host> hosts;
+	if (! obj.hasField ("hosts")) return hosts;
+	vector<mongo::BSONElement> hs = obj.getField("hosts").Array();
+	for (unsigned i = 0; i < hs.size(); i++) hosts.push_back (hs[i].String());
+	return hosts;
+}
+
+/** Node of deployment graph */
+struct Step {
+	string name;
+	vector<unsigned> deps;
+	boost::function0<void> action;
+	vector<unsigned> dependents;
+	unsigned waiting;  // deps not finished yet
+	boost::posix_time::ptime start, end;
+	Step (string name, boost::function0<void> action) : name(name), action(action), waiting(0) {}
+};
+
+/** Runs steps on executor as their dependencies finish */
+class Dag {
+	vector<Step>& steps;
+	boost::mutex mutex;
+	boost::condition_variable finished;
+	unsigned inFlight;
+	boost::optional<string> error;
+public:
+	Dag (vector<Step>& steps) : steps(steps), inFlight(0) {}
+	void run () {
+		for (unsigned i = 0; i < steps.size(); i++) {
+			steps[i].waiting = steps[i].deps.size();
+			for (unsigned j = 0; j < steps[i].deps.size(); j++) steps [steps[i].deps[j]] .dependents.push_back (i);
+		}
+		boost::mutex::scoped_lock lock (mutex);
+		for (unsigned i = 0; i < steps.size(); i++) if (steps[i].waiting == 0) submit (i);
+		while (inFlight > 0) finished.wait (lock);
+		if (error) throw runtime_error (*error);
+	}
+private:
+	/** Call with mutex locked */
+	void submit (unsigned i) {
+		inFlight ++;
+		mongoDeploy::executor() .submit (boost::bind (&Dag::exec, this, i));
+	}
+	void exec (unsigned i) {
+		Step& s = steps[i];
+		s.start = mongoDeploy::now();
+		boost::optional<string> err;
+		try {
+			mongoDeploy::Span span ("deploy step", s.name);
+			s.action();
+		}
+		catch (exception& e) {err = s.name + ": " + e.what();}
+		catch (const char* e) {err = s.name + ": " + e;}
+		catch (...) {err = s.name + ": unknown exception";}
+		boost::mutex::scoped_lock lock (mutex);
+		s.end = mongoDeploy::now();
+		if (err && ! error) error = err;
+		if (! error)  // after a failure, let running steps finish but start no more
+			for (unsigned j = 0; j < s.dependents.size(); j++)
+				if (-- steps [s.dependents[j]] .waiting == 0) submit (s.dependents[j]);
+		inFlight --;
+		finished.notify_all();
+	}
+};
+
+/** Cluster under construction, filled in by steps */
+struct Build {
+	mongoDeploy::ConfigSet configSet;
+	vector<mongoDeploy::MongoS> routers;
+	vector<mongoDeploy::ReplicaSet> shards;
+};
+
+static void startConfig (Build* b, vector<remote::Host> hosts, program::Options opts) {
+	b->configSet = mongoDeploy::startConfigSet (hosts, opts);}
+
+static void startRouter (Build* b, unsigned i, remote::Host host, program::Options opts) {
+	b->routers[i] = mongoDeploy::startMongoS (host, b->configSet, opts);
+	mongoDeploy::waitConnect (b->routers[i]);
+}
+
+static void startShard (Build* b, unsigned i, mongoDeploy::ReplicaSetSpec spec) {
+	b->shards[i] = mongoDeploy::startReplicaSet (spec.hosts, spec.memberSpecs, spec.rsSettings);}
+
+static void command (Build* b, mongo::BSONObj cmd) {
+	mongoDeploy::Connection c = mongoDeploy::routerSelector() .connect (b->routers);
+	mongoDeploy::Span span ("admin command", mongoDeploy::spanning() ? cmd.toString() : "");
+	mongo::BSONObj info;
+	bool ok = c->runCommand ("admin", cmd, info);
+	if (mongoDeploy::spanning()) span.outcome (info.toString());
+	if (! ok) throw runtime_error (cmd.toString() + " failed: " + info.toString());
+}
+
+static void addShard (Build* b, unsigned i) {
+	command (b, BSON ("addshard" << b->shards[i].nameActiveHosts()));}
+
+/** Stop every process started so far by build's finished steps, ignoring stop failures */
+static void stopBuild (Build& b) {
+	vector<mongoDeploy::Process> procs;
+	for (unsigned i = 0; i < b.configSet.cfgServers.size(); i++) procs.push_back (b.configSet.cfgServers[i]);
+	for (unsigned i = 0; i < b.routers.size(); i++) procs.push_back (b.routers[i]);
+	for (unsigned i = 0; i < b.shards.size(); i++) procs.insert (procs.end(), b.shards[i].replicas.begin(), b.shards[i].replicas.end());
+	vector<mongoDeploy::Process> launched;
+	for (unsigned i = 0; i < procs.size(); i++) if (procs[i].launched()) launched.push_back (procs[i]);
+	mongoDeploy::Span span ("stop failed deploy", to_string (launched.size()) + " processes");
+	try {mongoDeploy::stopProcesses (launched);}
+	catch (exception& e) {span.outcome (e.what());}
+}
+
+/** Step of critical path: the chain of dependencies ending in the step that finished last */
+static vector<bool> criticalPath (vector<Step>& steps) {
+	vector<bool> critical (steps.size());
+	if (steps.empty()) return critical;
+	unsigned last = 0;
+	for (unsigned i = 1; i < steps.size(); i++) if (steps[i].end > steps[last].end) last = i;
+	while (true) {
+		critical[last] = true;
+		if (steps[last].deps.empty()) break;
+		unsigned prev = steps[last].deps[0];
+		for (unsigned j = 1; j < steps[last].deps.size(); j++) if (steps [steps[last].deps[j]] .end > steps[prev].end) prev = steps[last].deps[j];
+		last = prev;
+	}
+	return critical;
+}
+
+/** Partition each host among the config servers, routers and shard members spec puts on it, plus spec's spareSlots, arbiters apart */
+static void planPlacement (mongo::BSONObj spec) {
+	vector<remote::Host> hosts = hostsOf (spec.getObjectField ("config"));
+	vector<remote::Host> routerHosts = hostsOf (spec.getObjectField ("routers"));
+	hosts.insert (hosts.end(), routerHosts.begin(), routerHosts.end());
+	vector<remote::Host> arbiterHosts;
+	vector<mongo::BSONElement> shards = spec.hasField ("shards") ? spec.getField("shards").Array() : vector<mongo::BSONElement>();
+	for (unsigned i = 0; i < shards.size(); i++) {
+		vector<mongo::BSONElement> ms = shards[i].Obj().getField("members").Array();
+		for (unsigned j = 0; j < ms.size(); j++) {
+			remote::Host host = string (ms[j].Obj().getStringField ("host"));
+			if (ms[j].Obj().getObjectField("config") ["arbiterOnly"] .trueValue()) arbiterHosts.push_back (host);
+			else hosts.push_back (host);
+		}
+	}
+	mongoDeploy::placement() .plan (hosts, arbiterHosts, max (spec["spareSlots"].numberInt(), 0));
+}
+
+mongoDeploy::ShardSet mongoDeploy::deploy (mongo::BSONObj spec, vector<StepTiming>* timings) {
+	Build b;
+	vector<Step> steps;
+	if (spec["pin"].trueValue()) planPlacement (spec);
+	mongo::BSONObj cfg = spec.getObjectField ("config");
+	steps.push_back (Step ("config servers", boost::bind (startConfig, &b, hostsOf (cfg), toOptions (cfg.getObjectField ("opts")))));
+	unsigned cfgStep = 0;
+
+	mongo::BSONObj rt = spec.getObjectField ("routers");
+	vector<remote::Host> routerHosts = hostsOf (rt);
+	if (routerHosts.empty()) throw runtime_error ("deploy spec has no routers");
+	b.routers.resize (routerHosts.size());
+	vector<unsigned> routerSteps;
+	for (unsigned i = 0; i < routerHosts.size(); i++) {
+		routerSteps.push_back (steps.size());
+		steps.push_back (Step ("router " + to_string (i), boost::bind (startRouter, &b, i, routerHosts[i], toOptions (rt.getObjectField ("opts")))));
+		steps.back().deps.push_back (cfgStep);
+	}
+
+	vector<mongo::BSONElement> shards = spec.hasField ("shards") ? spec.getField("shards").Array() : vector<mongo::BSONElement>();
+	b.shards.resize (shards.size());
+	vector<unsigned> addShardSteps;
+	for (unsigned i = 0; i < shards.size(); i++) {
+		mongo::BSONObj sh = shards[i].Obj();
+		vector<mongo::BSONElement> ms = sh.getField("members").Array();
+		vector<remote::Host> hosts;
+		vector<RsMemberSpec> members;
+		for (unsigned j = 0; j < ms.size(); j++) {
+			hosts.push_back (string (ms[j].Obj().getStringField ("host")));
+			members.push_back (RsMemberSpec (toOptions (ms[j].Obj().getObjectField ("opts")), ms[j].Obj().getObjectField("config").getOwned()));
+		}
+		unsigned rsStep = steps.size();
+		steps.push_back (Step ("replica set " + to_string (i), boost::bind (startShard, &b, i, ReplicaSetSpec (hosts, members, sh.getObjectField("settings").getOwned()))));
+		addShardSteps.push_back (steps.size());
+		steps.push_back (Step ("addshard " + to_string (i), boost::bind (addShard, &b, i)));
+		steps.back().deps = routerSteps;  // router selector picks among all routers, so all must be up
+		steps.back().deps.push_back (rsStep);
+	}
+
+	map<string, unsigned> dbSteps;
+	vector<mongo::BSONElement> dbs = spec.hasField ("databases") ? spec.getField("databases").Array() : vector<mongo::BSONElement>();
+	for (unsigned i = 0; i < dbs.size(); i++) {
+		if (addShardSteps.empty()) throw runtime_error ("deploy spec has databases but no shards");
+		dbSteps[dbs[i].String()] = steps.size();
+		steps.push_back (Step ("enablesharding " + dbs[i].String(), boost::bind (command, &b, BSON ("enablesharding" << dbs[i].String()))));
+		steps.back().deps.push_back (addShardSteps[0]);  // database is placed on a shard that is already added
+	}
+
+	vector<mongo::BSONElement> colls = spec.hasField ("collections") ? spec.getField("collections").Array() : vector<mongo::BSONElement>();
+	for (unsigned i = 0; i < colls.size(); i++) {
+		string ns = colls[i].Obj().getStringField ("ns");
+		string db = ns.substr (0, ns.find ('.'));
+		if (dbSteps.find (db) == dbSteps.end()) throw runtime_error ("collection " + ns + " of database not in deploy spec");
+		steps.push_back (Step ("shardcollection " + ns, boost::bind (command, &b, BSON ("shardcollection" << ns << "key" << colls[i].Obj().getObjectField("key").getOwned()))));
+		steps.back().deps.push_back (dbSteps[db]);
+	}
+
+	boost::posix_time::ptime start = mongoDeploy::now();
+	try {
+		Dag (steps) .run();
+	} catch (exception&) {
+		stopBuild (b);
+		throw;
+	}
+
+	vector<bool> critical = criticalPath (steps);
+	if (echoSpans) cout << "deploy steps (* critical path):" << endl;
+	for (unsigned i = 0; i < steps.size(); i++) {
+		StepTiming t (steps[i].name, (steps[i].start - start) .total_milliseconds(), (steps[i].end - steps[i].start) .total_milliseconds(), critical[i]);
+		if (echoSpans) cout << t << endl;
+		if (timings) timings->push_back (t);
+	}
+	ShardSet s (b.configSet, b.routers);
+	s.shards = b.shards;
+	return s;
+}
+
+/** Deploy from JSON spec */
+mongoDeploy::ShardSet mongoDeploy::deploy (string jsonSpec, vector<StepTiming>* timings) {
+	return deploy (mongo::fromjson (jsonSpec), timings);
+}
@@ -0,0 +1,37 @@
+/* Deploy a whole shard cluster from a declarative spec, running independent steps in parallel */
+
+#pragma once
+
+#include "mongoDeploy.h"
+
+namespace mongoDeploy {
+
+/** When a deployment step ran, relative to start of deployment */
+struct StepTiming {
+	std::string name;
+	unsigned startMillis;
+	unsigned millis;
+	bool critical;  // on the critical path (chain of dependencies that finished last)
+	StepTiming (std::string name, unsigned startMillis, unsigned millis, bool critical) : name(name), startMillis(startMillis), millis(millis), critical(critical) {}
+};
+
+/** Deploy shard cluster described by spec, eg.
+ * {config: {hosts: ["a"], opts: {}},
+ *  routers: {hosts: ["a", "b"], opts: {chunkSize: 2}},
+ *  shards: [{members: [{host: "a", opts: {oplogSize: 200}}, {host: "b"}, {host: "c", config: {arbiterOnly: true}}], settings: {}}],
+ *  databases: ["db"],
+ *  collections: [{ns: "db.coll", key: {_id: 1}}],
+ *  pin: true, spareSlots: 1}
+ * Options set to true are flags (eg. {dur: true}). With pin, placement() partitions each host among the processes the spec puts on it, plus spareSlots (0 by default) for processes added later, arbiters sharing a CPU set aside. Steps run as a dependency graph on executor(): config servers before routers, routers and each shard's replica set before its addshard, first shard before enablesharding, and database before its collections. Replica sets start while config servers and routers do. Per-step timings, critical path included, are appended to timings if given (and printed if echoSpans). On a step failure, stop the processes of steps that finished and raise the failure */
+ShardSet deploy (mongo::BSONObj spec, std::vector<StepTiming>* timings = 0);
+/** Deploy from JSON spec */
+ShardSet deploy (std::string jsonSpec, std::vector<StepTiming>* timings = 0);
+
+/** Options object (eg. {oplogSize: 200, dur: true}) as program options */
+program::Options toOptions (mongo::BSONObj);
+
+}
+
+inline std::ostream& operator<< (std::ostream& out, const mongoDeploy::StepTiming& x) {
+	out << (x.critical ? "* " : "  ") << x.name << " @" << x.startMillis << "ms " << x.millis << "ms";
+	return out;}
@@ -0,0 +1,64 @@
+/* */
+
+#include "executor.h"
+#include "allocator.h"
+#include "trace.h"
+
+using namespace std;
+
+mongoDeploy::Executor::Executor (unsigned threads) : stopping(false) {
+	for (unsigned i = 0; i < threads; i++) workers.create_thread (boost::bind (&Executor::work, this));
+}
+
+/** Finish queued tasks and join workers */
+mongoDeploy::Executor::~Executor () {
+	{
+		boost::mutex::scoped_lock lock (mutex);
+		stopping = true;
+	}
+	ready.notify_all();
+	workers.join_all();
+}
+
+/** Run task in allocator's scope, if any */
+static void inScope (boost::function0<void> task, mongoDeploy::Allocator* allocator) {
+	if (! allocator) {task(); return;}
+	mongoDeploy::AllocatorScope scope (*allocator);
+	task();
+}
+
+void mongoDeploy::Executor::submit (boost::function0<void> task) {
+	{
+		boost::mutex::scoped_lock lock (mutex);
+		queue.push_back (boost::bind (inScope, task, scopedAllocator()));
+	}
+	ready.notify_one();
+}
+
+void mongoDeploy::Executor::work () {
+	while (true) {
+		boost::function0<void> task;
+		{
+			boost::mutex::scoped_lock lock (mutex);
+			while (queue.empty() && ! stopping) ready.wait (lock);
+			if (queue.empty()) return;
+			task = queue.front();
+			queue.pop_front();
+		}
+		try {
+			task();
+		} catch (exception& e) {
+			Span span ("executor task failed");  // tasks are expected to report their own errors, this only leaves a trace
+			span.outcome (e.what());
+		} catch (...) {  // eg. boost::thread_interrupted, which would otherwise end this worker
+			Span span ("executor task failed");
+			span.outcome ("unknown exception");
+		}
+	}
+}
+
+/** Executor used by deploy. Never destroyed so running tasks outlive static destruction */
+mongoDeploy::Executor& mongoDeploy::executor () {
+	static Executor* e = new Executor (16);
+	return *e;
+}
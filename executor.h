@@ -0,0 +1,32 @@
+/* Fixed pool of worker threads running submitted tasks */
+
+#pragma once
+
+#include <deque>
+#include <boost/function.hpp>
+#include <boost/thread.hpp>
+#include <boost/noncopyable.hpp>
+
+namespace mongoDeploy {
+
+/** Runs submitted tasks on a fixed number of worker threads, in submission order. Tasks should not block waiting on other tasks of the same executor */
+class Executor : boost::noncopyable {
+public:
+	Executor (unsigned threads);
+	/** Finish queued tasks and join workers */
+	~Executor ();
+	/** Queue task to run in the caller's allocator scope (see allocator.h) */
+	void submit (boost::function0<void> task);
+private:
+	std::deque< boost::function0<void> > queue;
+	boost::mutex mutex;
+	boost::condition_variable ready;
+	bool stopping;
+	boost::thread_group workers;
+	void work ();
+};
+
+/** Executor used by deploy (16 threads) */
+Executor& executor ();
+
+}
@@ -0,0 +1,162 @@
+/* */
+
+#include "loader.h"
+#include "trace.h"
+#include <fstream>
+#include <deque>
+#include <cstring>
+
+using namespace std;
+
+/** Next document of stream into x. False at clean end of stream */
+static bool readBson (boost::shared_ptr<ifstream> in, mongo::BSONObj& x) {
+	char header[4];
+	in->read (header, 4);
+	if (in->gcount() == 0) return false;
+	if (in->gcount() < 4) throw runtime_error ("truncated BSON length");
+	int n = (unsigned char) header[0] | (unsigned char) header[1] << 8 | (unsigned char) header[2] << 16 | (unsigned char) header[3] << 24;
+	if (n < 5 || n > 16 * 1024 * 1024) throw runtime_error ("bad BSON length " + to_string (n));
+	char* data = (char*) malloc (n);  // BSONObj frees owned data with free()
+	if (! data) throw bad_alloc();
+	memcpy (data, header, 4);
+	in->read (data + 4, n - 4);
+	if (in->gcount() < n - 4 || data[n - 1] != 0) {
+		free (data);
+		throw runtime_error ("truncated BSON document");
+	}
+	x = mongo::BSONObj (data, true);
+	return true;
+}
+
+mongoDeploy::DocSource mongoDeploy::bsonFileSource (string path) {
+	boost::shared_ptr<ifstream> in (new ifstream (path.c_str(), ios::binary));
+	if (! *in) throw runtime_error ("can't open " + path);
+	return boost::bind (readBson, in, _1);
+}
+
+/** Bounded queue of batches between the reader and writers */
+struct BatchQueue {
+	deque< vector<mongo::BSONObj> > batches;
+	unsigned capacity;
+	bool closed;
+	boost::mutex mutex;
+	boost::condition_variable changed;
+	BatchQueue (unsigned capacity) : capacity(capacity), closed(false) {}
+	/** Wait for room, then queue batch */
+	void push (vector<mongo::BSONObj>& batch) {
+		boost::unique_lock<boost::mutex> lock (mutex);
+		while (batches.size() >= capacity) changed.wait (lock);
+		batches.push_back (vector<mongo::BSONObj>());
+		batches.back().swap (batch);
+		changed.notify_all();
+	}
+	/** Wait for a batch. False once closed and drained */
+	bool pop (vector<mongo::BSONObj>& batch) {
+		boost::unique_lock<boost::mutex> lock (mutex);
+		while (batches.empty() && ! closed) changed.wait (lock);
+		if (batches.empty()) return false;
+		batch.swap (batches.front());
+		batches.pop_front();
+		changed.notify_all();
+		return true;
+	}
+	void close () {
+		boost::mutex::scoped_lock lock (mutex);
+		closed = true;
+		changed.notify_all();
+	}
+};
+
+/** Insert batches from queue through router until queue is closed and drained */
+static void writer (string router, string ns, BatchQueue* q, bool acknowledge, mongoDeploy::LoadResult* result, boost::mutex* resultMutex) {
+	vector<mongo::BSONObj> batch;
+	while (q->pop (batch)) {
+		bool ok = true;
+		try {
+			mongoDeploy::Connection c = mongoDeploy::connectionPool() .get (router);
+			c->insert (ns, batch);
+			if (acknowledge) ok = c->getLastError() .empty();
+		} catch (exception& e) {ok = false;}
+		boost::mutex::scoped_lock lock (*resultMutex);
+		result->batches ++;
+		if (! ok) result->failedBatches ++;
+		batch.clear();
+	}
+}
+
+/** Chunk ranges of ns in shard key order and the shard index of each */
+struct ChunkMap {
+	mongo::BSONObj keyPattern;
+	vector<mongo::BSONObj> maxes;
+	vector<unsigned> shards;
+	/** Shard index of chunk containing key */
+	unsigned shardOf (const mongo::BSONObj& key) const {
+		unsigned lo = 0, hi = maxes.size() - 1;  // last chunk's max is MaxKey
+		while (lo < hi) {
+			unsigned mid = (lo + hi) / 2;
+			if (key.woCompare (maxes[mid], keyPattern, false) < 0) hi = mid; else lo = mid + 1;
+		}
+		return shards[lo];
+	}
+};
+
+static ChunkMap chunkMap (mongoDeploy::ShardSet& s, string ns) {
+	ChunkMap m;
+	mongoDeploy::Connection c = s.router();
+	mongo::BSONObj coll = c->findOne ("config.collections", BSON ("_id" << ns));
+	if (coll.isEmpty()) throw runtime_error (ns + " is not sharded");
+	m.keyPattern = coll.getObjectField ("key") .getOwned();
+	map<string,unsigned> index;
+	for (unsigned i = 0; i < s.shards.size(); i++) index[s.shards[i].name()] = i;
+	auto_ptr<mongo::DBClientCursor> cursor = c->query ("config.chunks", mongo::Query (BSON ("ns" << ns)) .sort ("min"));
+	while (cursor->more()) {
+		mongo::BSONObj chunk = cursor->next();
+		m.maxes.push_back (chunk.getObjectField ("max") .getOwned());
+		m.shards.push_back (index.count (chunk.getStringField ("shard")) ? index[chunk.getStringField ("shard")] : 0);
+	}
+	if (m.maxes.empty()) throw runtime_error ("no chunks for " + ns);
+	return m;
+}
+
+mongoDeploy::LoadResult mongoDeploy::bulkLoad (ShardSet& s, string ns, DocSource source, LoadOptions opts) {
+	Span span ("bulk load", ns);
+	LoadResult result (ns);
+	boost::posix_time::ptime start = now();
+	ChunkMap m = chunkMap (s, ns);
+	unsigned writers = s.routers.size() * max (1u, opts.writersPerRouter);
+	BatchQueue q (opts.queuedBatches > 0 ? opts.queuedBatches : 2 * writers);
+	boost::mutex resultMutex;
+	boost::thread_group threads;
+	for (unsigned i = 0; i < writers; i++)
+		threads.create_thread (boost::bind (writer, hostPortString (s.routers [i % s.routers.size()]), ns, &q, opts.acknowledge, &result, &resultMutex));
+	vector< vector<mongo::BSONObj> > pending (max ((size_t) 1, s.shards.size()));
+	vector<unsigned> pendingBytes (pending.size());
+	try {
+		mongo::BSONObj doc;
+		while (source (doc)) {
+			unsigned i = m.shardOf (doc.extractFields (m.keyPattern, true)) % pending.size();
+			pending[i].push_back (doc);
+			pendingBytes[i] += doc.objsize();
+			result.docs ++;
+			result.bytes += doc.objsize();
+			if (pending[i].size() >= opts.batchDocs || pendingBytes[i] >= opts.batchBytes) {
+				q.push (pending[i]);  // blocks while writers are behind
+				pendingBytes[i] = 0;
+			}
+		}
+		for (unsigned i = 0; i < pending.size(); i++) if (! pending[i].empty()) q.push (pending[i]);
+	} catch (...) {
+		q.close();
+		threads.join_all();
+		throw;
+	}
+	q.close();
+	threads.join_all();
+	result.millis = (now() - start) .total_milliseconds();
+	span.outcome (to_string (result.docs) + " docs");
+	return result;
+}
+
+mongoDeploy::LoadResult mongoDeploy::bulkLoad (ShardSet& s, string ns, string bsonFile, LoadOptions opts) {
+	return bulkLoad (s, ns, bsonFileSource (bsonFile), opts);
+}
@@ -0,0 +1,48 @@
+/* Stream documents into a sharded collection, batched by shard and inserted through all routers in parallel */
+
+#pragma once
+
+#include "mongoDeploy.h"
+
+namespace mongoDeploy {
+
+/** Source of documents to load. Sets its argument to the next document and returns true, or returns false at end of stream */
+typedef boost::function1<bool, mongo::BSONObj&> DocSource;
+
+/** Documents of a file of concatenated BSON (eg. a mongodump .bson file), read sequentially. Raise on a truncated or malformed document */
+DocSource bsonFileSource (std::string path);
+
+/** How bulkLoad batches and throttles */
+struct LoadOptions {
+	unsigned batchDocs;  // documents per insert (1000 by default)
+	unsigned batchBytes;  // bytes per insert (4MB by default), kept well under the message size limit
+	unsigned writersPerRouter;  // connections inserting through each router (2 by default)
+	unsigned queuedBatches;  // full batches waiting for a writer before reading pauses (2 per writer by default)
+	bool acknowledge;  // check getLastError after each batch (true by default). Errors are counted, not raised
+	LoadOptions (unsigned batchDocs = 1000, unsigned batchBytes = 4 << 20, unsigned writersPerRouter = 2, unsigned queuedBatches = 0, bool acknowledge = true) :
+		batchDocs(batchDocs), batchBytes(batchBytes), writersPerRouter(writersPerRouter), queuedBatches(queuedBatches), acknowledge(acknowledge) {}
+};
+
+/** Outcome of bulkLoad */
+struct LoadResult {
+	std::string ns;
+	unsigned long docs;
+	unsigned long bytes;
+	unsigned batches;
+	unsigned failedBatches;
+	unsigned millis;
+	LoadResult (std::string ns) : ns(ns), docs(0), bytes(0), batches(0), failedBatches(0), millis(0) {}
+	double docsPerSec () const {return millis > 0 ? docs * 1000.0 / millis : 0;}
+	double mbPerSec () const {return millis > 0 ? bytes * 1000.0 / millis / (1 << 20) : 0;}
+};
+
+/** Insert every document of source into sharded collection ns. Documents are routed by shard key against the chunk map read at start, so each batch targets one shard, and batches go round-robin to writers on every router. Reading blocks while opts.queuedBatches batches wait, so memory stays bounded. Chunks that split or move during the load only cost mongos extra routing */
+LoadResult bulkLoad (ShardSet&, std::string ns, DocSource source, LoadOptions opts = LoadOptions());
+/** bulkLoad of a file of concatenated BSON */
+LoadResult bulkLoad (ShardSet&, std::string ns, std::string bsonFile, LoadOptions opts = LoadOptions());
+
+}
+
+inline std::ostream& operator<< (std::ostream& out, const mongoDeploy::LoadResult& x) {
+	out << "LoadResult " << x.ns << " " << x.docs << " docs, " << x.bytes / (1 << 20) << "MB in " << x.millis << "ms (" << (unsigned long) x.docsPerSec() << " docs/sec, " << x.mbPerSec() << " MB/sec), " << x.batches << " batches, " << x.failedBatches << " failed";
+	return out;}
@@ -0,0 +1,122 @@
+/* */
+
+#include "localProcess.h"
+#include <stdexcept>
+#include <sstream>
+#include <cerrno>
+#include <cstring>
+#include <unistd.h>
+#include <signal.h>
+#include <sys/wait.h>
+
+using namespace std;
+
+/** Single-quote arg for sh */
+static string quote (string arg) {
+	string q = "'";
+	for (unsigned i = 0; i < arg.size(); i++) q += arg[i] == '\'' ? string ("'\\''") : string (1, arg[i]);
+	return q + "'";
+}
+
+/** Shell command line running executable with options in place of the shell */
+static string commandLine (string prefix, string executable, program::Options options) {
+	stringstream ss;
+	if (! prefix.empty()) ss << prefix << " && ";
+	ss << "exec " << executable;
+	for (unsigned i = 0; i < options.size(); i++) {
+		ss << " --" << options[i].first;
+		if (! options[i].second.empty()) ss << " " << quote (options[i].second);
+	}
+	return ss.str();
+}
+
+static pid_t spawn (string command) {
+	pid_t pid = fork();
+	if (pid < 0) throw runtime_error (string ("fork failed: ") + strerror (errno));
+	if (pid == 0) {
+		setpgid (0, 0);  // not killed by terminal signals meant for the driver
+		execl ("/bin/sh", "sh", "-c", command.c_str(), (char*) 0);
+		_exit (127);
+	}
+	return pid;
+}
+
+/** Run `prefix && executable --opt value ...` via /bin/sh, exec'ing executable so the process is the program itself */
+lprocess::Process lprocess::launch (string prefix, string executable, program::Options options) {
+	boost::shared_ptr<Process::State> s (new Process::State);
+	s->prefix = prefix;
+	s->executable = executable;
+	s->options = options;
+	s->status = 0;
+	s->exited = false;
+	s->child = true;
+	s->pid = spawn (commandLine (prefix, executable, options));
+	return Process (s);
+}
+
+/** Handle on a running process this one did not spawn. alive and wait poll it with kill (pid, 0) */
+lprocess::Process lprocess::adopt (pid_t pid, string executable, program::Options options) {
+	boost::shared_ptr<Process::State> s (new Process::State);
+	s->executable = executable;
+	s->options = options;
+	s->status = 0;
+	s->exited = false;
+	s->child = false;
+	s->pid = pid;
+	return Process (s);
+}
+
+void lprocess::signal (int sig, Process p) {
+	boost::mutex::scoped_lock lock (p.state->mutex);
+	if (! p.state->exited) kill (p.state->pid, sig);
+}
+
+/** False once process has exited. Reaps it without blocking */
+bool lprocess::alive (Process p) {
+	boost::mutex::scoped_lock lock (p.state->mutex);
+	if (p.state->exited) return false;
+	if (! p.state->child) p.state->exited = kill (p.state->pid, 0) != 0 && errno == ESRCH;
+	else if (waitpid (p.state->pid, &p.state->status, WNOHANG) == p.state->pid) p.state->exited = true;
+	return ! p.state->exited;
+}
+
+/** Block until process exits and return its wait status. Blocks without holding the lock, so signal, alive and options stay usable meanwhile */
+int lprocess::wait (Process p) {
+	pid_t pid;
+	{
+		boost::mutex::scoped_lock lock (p.state->mutex);
+		if (p.state->exited) return p.state->status;
+		pid = p.state->pid;
+		if (! p.state->child) {
+			lock.unlock();
+			while (alive (p)) boost::this_thread::sleep (boost::posix_time::milliseconds (100));
+			return 0;  // exit status of a process we did not spawn is unknown
+		}
+	}
+	int status = 0;
+	pid_t reaped;
+	while ((reaped = waitpid (pid, &status, 0)) < 0 && errno == EINTR);
+	boost::mutex::scoped_lock lock (p.state->mutex);
+	if (p.state->pid != pid) return status;  // restarted meanwhile
+	if (! p.state->exited) {  // else alive reaped it first and kept its status
+		p.state->exited = true;
+		if (reaped == pid) p.state->status = status;
+	}
+	return p.state->status;
+}
+
+/** Wait for process to exit if still running, then launch it again with same executable and options (not prefix, so data is kept) */
+void lprocess::restart (Process p) {
+	wait (p);
+	boost::mutex::scoped_lock lock (p.state->mutex);
+	if (! p.state->exited) return;  // another thread restarted it meanwhile
+	p.state->pid = spawn (commandLine ("", p.state->executable, p.state->options));
+	p.state->exited = false;
+	p.state->child = true;
+	p.state->status = 0;
+}
+
+program::Options lprocess::options (Process p) {
+	boost::mutex::scoped_lock lock (p.state->mutex);
+	return p.state->options;
+}
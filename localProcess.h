@@ -0,0 +1,55 @@
+/* Processes spawned directly on this machine with fork/exec, without 10remote */
+
+#pragma once
+
+#include <string>
+#include <10remote/process.h>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread.hpp>
+
+namespace lprocess {
+
+/** Process spawned on this machine. Copies refer to the same process. Offers the same operations as rprocess (signal, restart, program options) for local-only deployments */
+class Process {
+public:
+	struct State {
+		std::string prefix;  // shell command run before first launch only
+		std::string executable;
+		program::Options options;
+		pid_t pid;
+		int status;  // exit status once reaped
+		bool exited;
+		bool child;  // spawned by this process, so it can be reaped
+		boost::mutex mutex;
+	};
+	boost::shared_ptr<State> state;
+	Process () {}
+	Process (boost::shared_ptr<State> state) : state(state) {}
+	pid_t pid () const {return state->pid;}
+};
+
+/** Run `prefix && executable --opt value ...` via /bin/sh, exec'ing executable so the process is the program itself. Empty prefix is skipped */
+Process launch (std::string prefix, std::string executable, program::Options);
+
+/** Handle on a running process this one did not spawn, eg. after reattaching to a saved topology. It can't be reaped, so alive and wait poll it with kill (pid, 0) */
+Process adopt (pid_t pid, std::string executable, program::Options);
+
+/** Send signal to process */
+void signal (int sig, Process);
+
+/** Wait for process to exit if still running, then launch it again with same executable and options (not prefix, so data is kept) */
+void restart (Process);
+
+/** False once process has exited. Reaps it without blocking */
+bool alive (Process);
+
+/** Block until process exits and return its wait status */
+int wait (Process);
+
+program::Options options (Process);
+
+}
+
+inline std::ostream& operator<< (std::ostream& out, const lprocess::Process& x) {
+	out << "lprocess " << x.state->pid << " " << x.state->executable << " " << program::optionsString (x.state->options);
+	return out;}
@@ -0,0 +1,143 @@
+/* */
+
+#include "metrics.h"
+#include "parallel.h"
+#include <10util/util.h>
+
+using namespace std;
+
+mongoDeploy::MetricsCollector::MetricsCollector (ShardSet s, unsigned intervalMillis, unsigned capacity) : intervalMillis(intervalMillis), capacity(capacity) {
+	for (unsigned i = 0; i < s.configSet.cfgServers.size(); i++) targets.push_back (Target (s.configSet.cfgServers[i], "config", ""));
+	for (unsigned i = 0; i < s.routers.size(); i++) targets.push_back (Target (s.routers[i], "router", ""));
+	for (unsigned i = 0; i < s.shards.size(); i++)
+		for (unsigned j = 0; j < s.shards[i].replicas.size(); j++)
+			targets.push_back (Target (s.shards[i].replicas[j], "shard", s.shards[i].name()));
+}
+
+mongoDeploy::MetricsCollector::~MetricsCollector () {stop();}
+
+void mongoDeploy::MetricsCollector::record (string hostPort, string metric, Sample s) {
+	boost::mutex::scoped_lock lock (mutex);
+	map<string, Ring>& m = metrics[hostPort];
+	if (m.find (metric) == m.end()) m.insert (make_pair (metric, Ring (capacity)));
+	m.find(metric)->second.push (s);
+}
+
+/** Sum of all opcounters in serverStatus */
+static double opTotal (mongo::BSONObj status) {
+	double total = 0;
+	mongo::BSONObjIterator i (status.getObjectField ("opcounters"));
+	while (i.more()) total += i.next().number();
+	return total;
+}
+
+/** Seconds this replica is behind primary according to its own replSetGetStatus. None if there is no primary, eg. mid-election */
+static boost::optional<double> replLagSecs (mongo::BSONObj rsStatus) {
+	vector<mongo::BSONElement> ms = rsStatus.getField("members").Array();
+	long long primary = -1, self = -1;
+	for (unsigned i = 0; i < ms.size(); i++) {
+		mongo::BSONObj m = ms[i].Obj();
+		if (m.getIntField ("state") == 1) primary = m.getField("optimeDate").date();
+		if (m.getBoolField ("self")) self = m.getField("optimeDate").date();
+	}
+	if (primary < 0 || self < 0) return boost::none;
+	return max (0LL, primary - self) / 1000.0;
+}
+
+/** Poll one process and record its metrics. Failure records up = 0 */
+Unit mongoDeploy::MetricsCollector::poll (Target t) {
+	string hostPort = hostPortString (t.proc);
+	boost::posix_time::ptime time = mongoDeploy::now();
+	try {
+		Connection c = connectionPool() .get (hostPort);
+		mongo::BSONObj status;
+		if (! c->runCommand ("admin", BSON ("serverStatus" << 1), status)) throw runtime_error (status.toString());
+		record (hostPort, "up", Sample (time, 1));
+		Sample ops (time, opTotal (status));
+		boost::optional<Sample> prev;
+		{
+			boost::mutex::scoped_lock lock (mutex);
+			map<string, Sample>::iterator p = lastOps.find (hostPort);
+			if (p != lastOps.end()) prev = p->second;
+			lastOps.erase (hostPort);
+			lastOps.insert (make_pair (hostPort, ops));
+		}
+		double secs = prev ? (time - prev->time) .total_milliseconds() / 1000.0 : 0;
+		if (secs > 0 && ops.value >= prev->value) record (hostPort, "opsPerSec", Sample (time, (ops.value - prev->value) / secs));
+		record (hostPort, "connections", Sample (time, status.getObjectField("connections").getField("current").number()));
+		record (hostPort, "residentMb", Sample (time, status.getObjectField("mem").getField("resident").number()));
+		record (hostPort, "virtualMb", Sample (time, status.getObjectField("mem").getField("virtual").number()));
+		if (t.role == "shard") {
+			mongo::BSONObj rsStatus;
+			boost::optional<double> lag;
+			if (c->runCommand ("admin", BSON ("replSetGetStatus" << 1), rsStatus) && rsStatus.hasField ("members")) lag = replLagSecs (rsStatus);
+			if (lag) record (hostPort, "replLagSecs", Sample (time, *lag));
+		}
+	} catch (exception& e) {
+		record (hostPort, "up", Sample (time, 0));
+	}
+	return unit;
+}
+
+/** Poll all processes once, concurrently */
+void mongoDeploy::MetricsCollector::collect () {
+	vector< boost::function0<Unit> > polls;
+	for (unsigned i = 0; i < targets.size(); i++) polls.push_back (boost::bind (&MetricsCollector::poll, this, targets[i]));
+	parallel (polls);
+}
+
+void mongoDeploy::MetricsCollector::run () {
+	while (true) {
+		boost::posix_time::ptime next = mongoDeploy::now() + boost::posix_time::milliseconds (intervalMillis);
+		{
+			boost::this_thread::disable_interruption polling;  // parallel must join its threads before polls go out of scope
+			collect();
+		}
+		boost::this_thread::sleep (next);  // interruption point
+	}
+}
+
+/** Poll in background thread until stopped */
+void mongoDeploy::MetricsCollector::start () {
+	if (! poller) poller.reset (new boost::thread (boost::bind (&MetricsCollector::run, this)));
+}
+
+void mongoDeploy::MetricsCollector::stop () {
+	if (! poller) return;
+	poller->interrupt();
+	poller->join();
+	poller.reset();
+}
+
+vector<string> mongoDeploy::MetricsCollector::hostPorts () {
+	vector<string> hs;
+	for (unsigned i = 0; i < targets.size(); i++) hs.push_back (hostPortString (targets[i].proc));
+	return hs;
+}
+
+/** Recent samples of metric of process, oldest first */
+vector<mongoDeploy::Sample> mongoDeploy::MetricsCollector::series (string hostPort, string metric) {
+	boost::mutex::scoped_lock lock (mutex);
+	map<string, Ring>& m = metrics[hostPort];
+	map<string, Ring>::iterator r = m.find (metric);
+	return r == m.end() ? vector<Sample>() : r->second.all();
+}
+
+/** Latest sample of every metric of every process, in Prometheus text exposition format, eg. `mongo_opsPerSec{instance="host:27101",role="shard",replset="rs1"} 1234 1318000000000` */
+string mongoDeploy::MetricsCollector::prometheus () {
+	static const boost::posix_time::ptime epoch (boost::gregorian::date (1970, 1, 1));
+	boost::mutex::scoped_lock lock (mutex);
+	stringstream out;
+	for (unsigned i = 0; i < targets.size(); i++) {
+		string hostPort = hostPortString (targets[i].proc);
+		map<string, Ring>& m = metrics[hostPort];
+		for (map<string, Ring>::iterator r = m.begin(); r != m.end(); ++r) {
+			if (r->second.empty()) continue;
+			Sample s = r->second.last();
+			out << "mongo_" << r->first << "{instance=\"" << hostPort << "\",role=\"" << targets[i].role << "\"";
+			if (! targets[i].replSet.empty()) out << ",replset=\"" << targets[i].replSet << "\"";
+			out << "} " << s.value << " " << (s.time - epoch) .total_milliseconds() << "\n";
+		}
+	}
+	return out.str();
+}
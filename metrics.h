@@ -0,0 +1,68 @@
+/* Periodically poll every process of a shard set and keep recent metrics in memory */
+
+#pragma once
+
+#include "mongoDeploy.h"
+#include <deque>
+#include <10util/util.h>
+
+namespace mongoDeploy {
+
+/** Metric value at a point in time */
+struct Sample {
+	boost::posix_time::ptime time;
+	double value;
+	Sample (boost::posix_time::ptime time, double value) : time(time), value(value) {}
+};
+
+/** Most recent samples of a metric, oldest dropped beyond capacity */
+class Ring {
+	std::deque<Sample> samples;
+	unsigned capacity;
+public:
+	Ring (unsigned capacity = 600) : capacity(capacity) {}
+	void push (Sample s) {samples.push_back (s); if (samples.size() > capacity) samples.pop_front();}
+	std::vector<Sample> all () const {return std::vector<Sample> (samples.begin(), samples.end());}
+	bool empty () const {return samples.empty();}
+	Sample last () const {return samples.back();}
+};
+
+/** Polls serverStatus of every config server, router and replica, and replSetGetStatus of every replica, concurrently every intervalMillis.
+ * Metrics per host:port: "up" (1/0), "opsPerSec" (all opcounters), "connections", "residentMb", "virtualMb", and for replicas "replLagSecs" (behind primary) */
+class MetricsCollector : boost::noncopyable {
+public:
+	MetricsCollector (ShardSet, unsigned intervalMillis = 1000, unsigned capacity = 600);
+	/** Stops collecting */
+	~MetricsCollector ();
+	/** Poll in background thread until stopped */
+	void start ();
+	void stop ();
+	/** Poll all processes once, now */
+	void collect ();
+	/** Processes being polled */
+	std::vector<std::string> hostPorts ();
+	/** Recent samples of metric of process, oldest first */
+	std::vector<Sample> series (std::string hostPort, std::string metric);
+	/** Latest sample of every metric of every process, in Prometheus text exposition format */
+	std::string prometheus ();
+private:
+	/** What a process is, for labels */
+	struct Target {
+		Process proc;
+		std::string role;  // config, router or shard
+		std::string replSet;  // shard's replica set name, empty for others
+		Target (Process proc, std::string role, std::string replSet) : proc(proc), role(role), replSet(replSet) {}
+	};
+	std::vector<Target> targets;
+	unsigned intervalMillis;
+	unsigned capacity;
+	std::map< std::string, std::map<std::string, Ring> > metrics;
+	std::map<std::string, Sample> lastOps;  // opcounter total at previous poll, for rate
+	boost::mutex mutex;
+	boost::shared_ptr<boost::thread> poller;
+	void record (std::string hostPort, std::string metric, Sample);
+	Unit poll (Target);
+	void run ();
+};
+
+}
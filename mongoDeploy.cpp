@@ -1,45 +1,119 @@
 /* */
 
 #include "mongoDeploy.h"
+#include "parallel.h"
+#include "allocator.h"
+#include "routers.h"
+#include "trace.h"
+#include "placement.h"
+#include "supervisor.h"
 #include <10util/util.h>
 #include <boost/algorithm/string.hpp>
 #include <10util/thread.h>
 #include <10util/except.h>
+#include <algorithm>
+#include <boost/functional/hash.hpp>
+#include <csignal>
+#include <deque>
 
 using namespace std;
 
+/** Launch and probe the processes of a set concurrently (default). Set false to bring them up one at a time */
+bool mongoDeploy::concurrentStart = true;
+
 /** Connection **/
 
 static unsigned DefaultPort = 27017;
 
 /** Host and port of a mongoD/S process */
-string mongoDeploy::hostPortString (remote::Process mongoProcess) {
-	boost::optional<string> port = program::lookup ("port", remote::program(mongoProcess).options);
+string mongoDeploy::hostPortString (Process mongoProcess) {
+	boost::optional<string> port = program::lookup ("port", programOptions (mongoProcess));
 	return remote::hostPort(mongoProcess.host).hostname + ":" + (port ? *port : to_string(DefaultPort));
 }
 
-mongo::HostAndPort mongoDeploy::hostAndPort (remote::Process mongoProcess) {
+mongo::HostAndPort mongoDeploy::hostAndPort (Process mongoProcess) {
 	return mongo::HostAndPort (hostPortString (mongoProcess));
 }
 
-/** Try to connect every 2 secs until successful. Give up after maxSecs (60 secs by default) */
-mongoDeploy::Connection mongoDeploy::waitConnect (string hostPort, unsigned maxSecs) {
-	unsigned secs = 0;
+/** Backoff used when none supplied (60 sec deadline, 5ms to 500ms between retries) */
+mongoDeploy::Backoff mongoDeploy::defaultBackoff;
+
+mongoDeploy::Retry::Retry (Backoff backoff) : backoff(backoff), start(now()), delayMillis(backoff.initialMillis), attempts(1) {}
+
+unsigned mongoDeploy::Retry::elapsedMillis () {
+	return (now() - start) .total_milliseconds();}
+
+/** Sleep until next attempt. Return false without sleeping if deadline would pass */
+bool mongoDeploy::Retry::sleep () {
+	unsigned elapsed = elapsedMillis();
+	if (elapsed >= backoff.deadlineMillis) return false;
+	unsigned delay = min (delayMillis, backoff.deadlineMillis - elapsed);
+	boost::this_thread::sleep (boost::posix_time::milliseconds (delay));
+	delayMillis = min (backoff.maxMillis, max (delayMillis + 1, (unsigned) (delayMillis * backoff.factor)));
+	attempts ++;
+	return true;
+}
+
+/** Most ready times kept. Older ones are dropped as new ones come in (10000 by default) */
+unsigned mongoDeploy::readyTimesCapacity = 10000;
+
+static deque<mongoDeploy::ReadyTime> readyLog;
+static boost::mutex readyLogMutex;
+
+static void recordReady (string what, mongoDeploy::Retry& r) {
+	boost::mutex::scoped_lock lock (readyLogMutex);
+	readyLog.push_back (mongoDeploy::ReadyTime (what, r.elapsedMillis(), r.attempts));
+	while (readyLog.size() > mongoDeploy::readyTimesCapacity) readyLog.pop_front();
+}
+
+/** Ready times recorded by waitConnect and startReplicaSet, oldest first */
+vector<mongoDeploy::ReadyTime> mongoDeploy::readyTimes () {
+	boost::mutex::scoped_lock lock (readyLogMutex);
+	return vector<mongoDeploy::ReadyTime> (readyLog.begin(), readyLog.end());
+}
+
+void mongoDeploy::clearReadyTimes () {
+	boost::mutex::scoped_lock lock (readyLogMutex);
+	readyLog.clear();
+}
+
+/** Try to connect following backoff schedule until successful. Raise last connect error after deadline */
+mongoDeploy::Connection mongoDeploy::waitConnect (string hostPort, Backoff backoff) {
+	Span span ("connect", hostPort);
+	Retry r (backoff);
 	while (true)
 		try {
-			Connection c (new mongo::DBClientConnection);
-			c->connect (hostPort);
+			Connection c = connectionPool() .get (hostPort);
+			recordReady (hostPort, r);
+			span.outcome (to_string (r.attempts) + " attempts");
 			return c;
 		} catch (exception &e) {
-			if (secs >= maxSecs) except::raise (e);
-			thread::sleep (2);
-			secs += 2;
+			if (! r.sleep()) except::raise (e);
 		}
 }
 
-/** Try to connect every 2 secs until successful. Give up after maxSecs (60 secs by default) */
-mongoDeploy::Connection mongoDeploy::waitConnect (remote::Process mongoProcess, unsigned maxSecs) {
-	return waitConnect (hostPortString (mongoProcess), maxSecs);}
+mongoDeploy::Connection mongoDeploy::waitConnect (Process mongoProcess, Backoff backoff) {
+	return waitConnect (hostPortString (mongoProcess), backoff);}
+
+/** waitConnect with default timeout, for binding */
+static mongoDeploy::Connection probe (mongoDeploy::Process mongoProcess) {
+	return mongoDeploy::waitConnect (mongoProcess);}
+
+/** Wait until every process accepts connections, probing them concurrently if concurrentStart */
+static vector<mongoDeploy::Connection> probeAll (vector<mongoDeploy::Process> procs) {
+	vector< boost::function0<mongoDeploy::Connection> > probes;
+	for (unsigned i = 0; i < procs.size(); i++) probes.push_back (boost::bind (probe, procs[i]));
+	return mongoDeploy::runAll (mongoDeploy::concurrentStart, probes);
+}
+
+/** Run command on admin database. Raise if it fails */
+static void adminCommand (mongoDeploy::Connection c, mongo::BSONObj cmd) {
+	mongoDeploy::Span span ("admin command", mongoDeploy::spanning() ? cmd.toString() : "");
+	mongo::BSONObj info;
+	bool ok = c->runCommand ("admin", cmd, info);
+	if (mongoDeploy::spanning()) span.outcome (info.toString());
+	if (! ok) throw runtime_error (cmd.toString() + " failed: " + info.toString());
+}
 
 /** MongoD **/
 
@@ -48,23 +122,158 @@ string mongoDeploy::mongoDbPathPrefix = "dbms";  // in current directory
 /** Default MongoD config is merged with user supplied config. User config options take precedence */
 program::Options mongoDeploy::defaultMongoD;
 
-static volatile unsigned long nextDbPath;
+static unsigned long nextDbPath;
+static unsigned long nextReplicaSetId;
+static boost::mutex nextIdMutex;
+
+/** Increment counter and return new value. Safe for concurrent launches */
+static unsigned long newId (unsigned long& counter) {
+	boost::mutex::scoped_lock lock (nextIdMutex);
+	return ++ counter;
+}
+
+mongoDeploy::Counters mongoDeploy::counters () {
+	boost::mutex::scoped_lock lock (nextIdMutex);
+	Counters c;
+	c.nextDbPath = nextDbPath;
+	c.nextReplicaSetId = nextReplicaSetId;
+	return c;
+}
+
+/** Advance counters to at least the given values */
+void mongoDeploy::advanceCounters (Counters c) {
+	boost::mutex::scoped_lock lock (nextIdMutex);
+	nextDbPath = max (nextDbPath, c.nextDbPath);
+	nextReplicaSetId = max (nextReplicaSetId, c.nextReplicaSetId);
+}
+
+/** How startMongoD prepares a fresh dbpath */
+mongoDeploy::DbPathInit mongoDeploy::dbPathInit = EmptyDbPath;
+
+/** Options that change the files mongod preallocates, so templates made with different values can't be shared */
+static const char* FileLayoutOptions[] = {"dur", "journal", "nojournal", "smallfiles", "noprealloc", "nssize"};
+
+/** Template dbpath for host's mongod version (appended by shell) and options' file layout */
+static string templatePath (program::Options opts) {
+	stringstream key;
+	for (unsigned i = 0; i < sizeof FileLayoutOptions / sizeof *FileLayoutOptions; i++) {
+		boost::optional<string> v = program::lookup (FileLayoutOptions[i], opts);
+		if (v) key << FileLayoutOptions[i] << "=" << *v << ";";
+	}
+	vector<string>& roots = mongoDeploy::allocator() .dataRoots;
+	string dir = roots.empty() ? "" : roots[0] + "/";
+	return dir + mongoDeploy::mongoDbPathPrefix + "-template-" + to_string (boost::hash<string>() (key.str()));
+}
+
+/** Shell command run before mongod to prepare its empty dbpath according to dbPathInit.
+ * Template modes initialize the template once per host, mongod version and file layout (by starting mongod on it, on the new process's port, and shutting it down), serialized by flock. The new dbpath is then cloned from it */
+static string dbPathSetup (string path, string port, program::Options opts) {
+	stringstream ss;
+	if (mongoDeploy::dbPathInit == mongoDeploy::EmptyDbPath) {
+		ss << "rm -rf " << path << " && mkdir -p " << path;
+		return ss.str();
+	}
+	stringstream layout;
+	for (unsigned i = 0; i < sizeof FileLayoutOptions / sizeof *FileLayoutOptions; i++) {
+		boost::optional<string> v = program::lookup (FileLayoutOptions[i], opts);
+		if (v) layout << " --" << FileLayoutOptions[i] << (v->empty() ? "" : " " + *v);
+	}
+	string cp = mongoDeploy::dbPathInit == mongoDeploy::ReflinkTemplate ? "cp -a --reflink=auto" : "cp -a";
+	ss << "T=" << templatePath (opts) << "-$(mongod --version | head -1 | tr -cd 0-9.)"
+		<< " && mkdir -p $(dirname $T)"
+		<< " && (flock 9 && if [ ! -d $T ]; then"
+			<< " rm -rf $T.init && mkdir -p $T.init"
+			<< " && mongod --dbpath $T.init --port " << port << layout.str() << " --fork --logpath $T.init.log"
+			<< " && kill $(cat $T.init/mongod.lock) && while [ -s $T.init/mongod.lock ]; do sleep 0.1; done"
+			<< " && rm -f $T.init/mongod.lock && mv $T.init $T;"
+		<< " fi) 9>$T.lock"
+		<< " && rm -rf " << path << " && mkdir -p $(dirname " << path << ") && " << cp << " $T " << path;
+	return ss.str();
+}
+
+/** User options + generated dbpath and port if not supplied + defaultMongoD options where not supplied */
+static program::Options mongoDOptions (remote::Host host, program::Options options) {
+	using namespace mongoDeploy;
+	program::Options given = program::merge (defaultMongoD, options);
+	string hostname = remote::hostPort(host).hostname;
+	program::Options config;
+	config.push_back (make_pair (string ("rest"), ""));
+	if (! program::lookup ("dbpath", given))
+		config.push_back (make_pair (string ("dbpath"), allocator() .allocDbPath (hostname, allocator() .namePrefix + mongoDbPathPrefix + to_string (newId (nextDbPath)))));
+	if (! program::lookup ("port", given))
+		config.push_back (make_pair (string ("port"), to_string (allocator() .allocPort (hostname))));
+	return program::merge (config, given);  //user options have precedence
+}
+
+/** Arbiters hold no data, so keep their files small */
+static program::Options arbiterOptions () {
+	return program::options ("smallfiles", "", "noprealloc", "", "oplogSize", "1");
+}
+
+/** startMongoD, pinned per placement(). Arbiters get a minimal footprint: small files and the host's arbiter CPU */
+static mongoDeploy::MongoD launchMongoD (remote::Host host, program::Options options, bool arbiter) {
+	using namespace mongoDeploy;
+	string hostname = remote::hostPort(host).hostname;
+	program::Options config2 = mongoDOptions (host, arbiter ? program::merge (arbiterOptions(), options) : options);
+	string path = * program::lookup ("dbpath", config2);
+	string port = * program::lookup ("port", config2);
+	Span span ("launch mongod", hostname + ":" + port);
+	return launch (host, dbPathSetup (path, port, config2), placement() .wrap (hostname, arbiter) + "mongod", config2);
+}
 
 /** start mongod program with given options +
  * unique values generated for dbpath and port options if not already supplied +.
  * defaultMongoD options where not already supplied. */
 mongoDeploy::MongoD mongoDeploy::startMongoD (remote::Host host, program::Options options) {
-	program::Options config;
-	config.push_back (make_pair (string ("rest"), ""));
-	config.push_back (make_pair (string ("dbpath"), mongoDbPathPrefix + to_string (++ nextDbPath)));
-	config.push_back (make_pair (string ("port"), to_string (27100 + nextDbPath)));
-	program::Options config1 = program::merge (config, defaultMongoD);
-	program::Options config2 = program::merge (config1, options);  //user options have precedence
+	return launchMongoD (host, options, false);
+}
+
+/** startMongoD on this machine without 10remote, with the same generated options and dbpath setup */
+mongoDeploy::LocalMongoD mongoDeploy::startLocalMongoD (program::Options options) {
+	program::Options config2 = mongoDOptions ("localhost", options);
 	string path = * program::lookup ("dbpath", config2);
-	stringstream ss;
-	ss << "rm -rf " << path << " && mkdir -p " << path;
-	program::Program program (ss.str(), "mongod", config2);
-	return remote::launch (program, host);
+	string port = * program::lookup ("port", config2);
+	Span span ("launch local mongod", "localhost:" + port);
+	return lprocess::launch (dbPathSetup (path, port, config2), placement() .wrap ("localhost") + "mongod", config2);
+}
+
+/** Return process's port and dbpath to the allocator for reuse. Call after stopping it */
+void mongoDeploy::releaseProcess (Process p) {
+	string hostname = remote::hostPort(p.host).hostname;
+	program::Options opts = programOptions (p);
+	if (program::lookup ("port", opts)) allocator() .releasePort (hostname, hostAndPort (p) .port());
+	boost::optional<string> path = program::lookup ("dbpath", opts);
+	if (path) allocator() .releaseDbPath (hostname, *path);
+	connectionPool() .clear (hostPortString (p));
+}
+
+/** Terminate process (mongo shuts down cleanly on SIGTERM) and wait until its port is closed. Its port and dbpath stay reserved */
+void mongoDeploy::terminate (Process p, Backoff backoff) {
+	unsupervise (p);
+	signalProcess (SIGTERM, p);
+	mongo::HostAndPort hp = hostAndPort (p);
+	Retry r (backoff);
+	while (portInUse (hp.host(), hp.port()))
+		if (! r.sleep()) throw runtime_error ("process did not stop: " + hp.toString());
+	connectionPool() .clear (hp.toString());
+}
+
+/** Terminate process and release its port and dbpath for reuse */
+void mongoDeploy::stopProcess (Process p, Backoff backoff) {
+	terminate (p, backoff);
+	releaseProcess (p);
+}
+
+static Unit stopUnit (mongoDeploy::Process p) {
+	mongoDeploy::stopProcess (p);
+	return unit;
+}
+
+/** stopProcess each process, concurrently */
+void mongoDeploy::stopProcesses (vector<Process> procs) {
+	vector< boost::function0<Unit> > stops;
+	for (unsigned i = 0; i < procs.size(); i++) stops.push_back (boost::bind (stopUnit, procs[i]));
+	parallel (stops);
 }
 
 /** Replica set */
@@ -82,50 +291,65 @@ static bool goodReplStatus (mongo::BSONObj &info) {
 	return primary;
 }
 
-static mongo::BSONObj waitForGoodReplStatus (mongoDeploy::Connection c, unsigned maxSecs = 60) {
-	unsigned secs = 0;
+/** Poll replSetGetStatus following backoff schedule until good. Time taken is recorded in readyTimes under rsName */
+static mongo::BSONObj waitForGoodReplStatus (mongoDeploy::Connection c, string rsName, mongoDeploy::Backoff backoff = mongoDeploy::defaultBackoff) {
+	mongoDeploy::Retry r (backoff);
 	mongo::BSONObj info;
 	while (true) {
-		if (secs >= maxSecs) throw runtime_error ("replica set failed to initiate: " + to_string (info));
 		c->runCommand ("admin", BSON ("replSetGetStatus" << 1), info);
-		if (goodReplStatus (info)) return info;
-		thread::sleep (2);
-		secs += 2;
+		if (goodReplStatus (info)) {recordReady (rsName, r); return info;}
+		if (! r.sleep()) throw runtime_error ("replica set failed to initiate: " + to_string (info));
 	}
 }
 
-static volatile unsigned long nextReplicaSetId;
+
+static bool isArbiter (mongoDeploy::RsMemberSpec spec) {return spec.memberConfig["arbiterOnly"].trueValue();}
 
 /** Start replica set with given member specs and config options + generated 'replSet' and options filled in by 'startMongoD' (if not already supplied) */
 mongoDeploy::ReplicaSet mongoDeploy::startReplicaSet (vector<remote::Host> hosts, vector<RsMemberSpec> memberSpecs, mongo::BSONObj rsSettings) {
 	assert (hosts.size() == memberSpecs.size());
 	if (memberSpecs.size() == 0) throw runtime_error ("can't create empty replica set");
 	program::Options options;
-	string rsName = "rs" + to_string (++ nextReplicaSetId);
+	string rsName = allocator() .namePrefix + "rs" + to_string (newId (nextReplicaSetId));
 	options.push_back (make_pair ("replSet", rsName));
-	vector<MongoD> replicas;
+	vector< boost::function0<MongoD> > launches;
+	for (unsigned i = 0; i < min (hosts.size(), memberSpecs.size()); i++)
+		launches.push_back (boost::bind (launchMongoD, hosts[i], program::merge (options, memberSpecs[i].opts), isArbiter (memberSpecs[i])));
+	vector<MongoD> replicas = runAll (concurrentStart, launches);
 	mongo::BSONArrayBuilder members;
-	for (unsigned i = 0; i < min (hosts.size(), memberSpecs.size()); i++) {
-		MongoD p = startMongoD (hosts[i], program::merge (options, memberSpecs[i].opts));
-		replicas.push_back (p);
+	for (unsigned i = 0; i < replicas.size(); i++) {
 		mongo::BSONObjBuilder obj;
-		obj.appendElements (BSON ("_id" << i << "host" << hostPortString (p)));
+		obj.appendElements (BSON ("_id" << i << "host" << hostPortString (replicas[i])));
 		obj.appendElements (memberSpecs[i].memberConfig);
 		members.append (obj.done());
 	}
-	Connection c = waitConnect (replicas[0]);
-	for (unsigned i = 1; i < replicas.size(); i++) waitConnect (replicas[i]);
+	Connection c = probeAll (replicas) [0];
 	mongo::BSONObj rsConfig = BSON ("_id" << rsName << "members" << members.arr() << "settings" << rsSettings);
-    mongo::BSONObj info;
-    cout << "replSetInitiate: " << rsConfig << " ->" << endl;
-    c->runCommand ("admin", BSON ("replSetInitiate" << rsConfig), info);
-    cout << " " << info << endl;
-    cout << "replSetGetStatus -> " << flush;
-    info = waitForGoodReplStatus (c);
-    cout << info << endl;
+	mongo::BSONObj info;
+	{
+		Span span ("replSetInitiate", spanning() ? rsConfig.toString() : "");
+		c->runCommand ("admin", BSON ("replSetInitiate" << rsConfig), info);
+		if (spanning()) span.outcome (info.toString());
+	}
+	{
+		Span span ("wait replica set", rsName);
+		info = waitForGoodReplStatus (c, rsName);
+		if (spanning()) span.outcome (info.toString());
+	}
 	return ReplicaSet (replicas, memberSpecs);
 }
 
+/** startReplicaSet on spec, for binding */
+static mongoDeploy::ReplicaSet startReplicaSetSpec (mongoDeploy::ReplicaSetSpec spec) {
+	return mongoDeploy::startReplicaSet (spec.hosts, spec.memberSpecs, spec.rsSettings);}
+
+/** Start each replica set, concurrently if concurrentStart */
+vector<mongoDeploy::ReplicaSet> mongoDeploy::startReplicaSets (vector<ReplicaSetSpec> specs) {
+	vector< boost::function0<ReplicaSet> > starts;
+	for (unsigned i = 0; i < specs.size(); i++) starts.push_back (boost::bind (startReplicaSetSpec, specs[i]));
+	return runAll (concurrentStart, starts);
+}
+
 /** Extract replica set name from replica set name + seed list */
 static string parseReplSetName (string replSetString) {
 	vector<string> parts;
@@ -134,7 +358,7 @@ static string parseReplSetName (string replSetString) {
 }
 
 string mongoDeploy::ReplicaSet::name () {
-	string replSetString = * program::lookup ("replSet", remote::program (replicas[0]) .options);
+	string replSetString = * program::lookup ("replSet", programOptions (replicas[0]));
 	return parseReplSetName (replSetString);
 }
 
@@ -156,40 +380,171 @@ string mongoDeploy::ReplicaSet::nameActiveHosts () {
 	return name() + "/" + concat (intersperse (string(","), fmap (hostPortString, activeReplicas())));
 }
 
-static void addReplica (mongoDeploy::ReplicaSet rs, remote::Process mongod, mongo::BSONObj memberConfig) {
-	vector<mongo::HostAndPort> hs = fmap (mongoDeploy::hostAndPort, rs.replicas);
-	mongo::DBClientReplicaSet c (rs.name(), hs);
-	bool ok = c.connect();
-	if (!ok) throw runtime_error ("Unable to connect to replica set " + rs.name());
+/** Pooled connection to current primary. Raise if there is none */
+mongoDeploy::Connection mongoDeploy::ReplicaSet::primary () {
+	vector<MongoD> active = activeReplicas();
+	for (unsigned i = 0; i < active.size(); i++)
+		try {
+			Connection c = connectionPool() .get (hostPortString (active[i]));
+			mongo::BSONObj info;
+			c->runCommand ("admin", BSON ("isMaster" << 1), info);
+			if (info.getBoolField ("ismaster")) return c;
+		} catch (exception& e) {}  // try next replica
+	throw runtime_error ("No primary in replica set " + name());
+}
 
-	mongo::BSONObj cfg = c.findOne ("local.system.replset", mongo::BSONObj());
+/** Current replica set config, read from primary */
+static mongo::BSONObj replSetConfig (mongoDeploy::ReplicaSet rs) {
+	mongo::BSONObj cfg = rs.primary() ->findOne ("local.system.replset", mongo::BSONObj());
 	if (cfg.isEmpty()) throw runtime_error ("Missing replica set config " + rs.name());
+	return cfg.getOwned();
+}
+
+/** Install config with given members and next version via replSetReconfig on primary, and wait until primary reports it */
+static void reconfig (mongoDeploy::ReplicaSet rs, mongo::BSONObj cfg, mongo::BSONArray members) {
 	int ver = cfg.getIntField ("version");
-	cfg = cfg.replaceFieldNames (BSON ("version" << ver+1));
-	throw "TODO: finish addReplica";
+	mongo::BSONObjBuilder newCfg;
+	newCfg.append ("_id", rs.name());
+	newCfg.append ("version", ver + 1);
+	newCfg.append ("members", members);
+	if (cfg.hasField ("settings")) newCfg.append (cfg.getField ("settings"));
+	mongo::BSONObj cmd = BSON ("replSetReconfig" << newCfg.obj());
+	mongo::BSONObj info;
+	mongoDeploy::Span span ("replSetReconfig", mongoDeploy::spanning() ? cmd.toString() : "");
+	try {
+		rs.primary() ->runCommand ("admin", cmd, info);
+		if (mongoDeploy::spanning()) span.outcome (info.toString());
+	} catch (exception& e) {
+		span.outcome (e.what());  // primary drops its connections on reconfig, so check outcome below
+	}
+	mongoDeploy::Retry r (mongoDeploy::defaultBackoff);
+	while (true) {
+		try {
+			if (replSetConfig (rs) .getIntField ("version") > ver) return;
+		} catch (exception& e) {}  // no primary during reconfig
+		if (! r.sleep()) throw runtime_error ("replSetReconfig failed: " + info.toString());
+	}
+}
+
+/** Add mongod as new member of replica set */
+static void addReplica (mongoDeploy::ReplicaSet rs, mongoDeploy::Process mongod, mongo::BSONObj memberConfig) {
+	mongo::BSONObj cfg = replSetConfig (rs);
+	vector<mongo::BSONElement> ms = cfg.getField("members").Array();
+	mongo::BSONArrayBuilder members;
+	int id = 0;
+	for (unsigned i = 0; i < ms.size(); i++) {
+		members.append (ms[i].Obj());
+		id = max (id, ms[i].Obj().getIntField ("_id") + 1);
+	}
+	mongo::BSONObjBuilder m;
+	m.appendElements (BSON ("_id" << id << "host" << mongoDeploy::hostPortString (mongod)));
+	m.appendElements (memberConfig);
+	members.append (m.done());
+	reconfig (rs, cfg, members.arr());
+}
+
+/** State of member hostPort according to primary (1 primary, 2 secondary, 7 arbiter, ...), -1 if not listed */
+static int memberState (mongoDeploy::ReplicaSet rs, string hostPort) {
+	mongo::BSONObj info;
+	rs.primary() ->runCommand ("admin", BSON ("replSetGetStatus" << 1), info);
+	if (! info.hasField ("members")) return -1;
+	vector<mongo::BSONElement> ms = info.getField("members").Array();
+	for (unsigned i = 0; i < ms.size(); i++)
+		if (ms[i].Obj().getStringField ("name") == hostPort) return ms[i].Obj().getIntField ("state");
+	return -1;
+}
+
+/** A secondary of replica set to copy data files from */
+static mongoDeploy::MongoD seedSource (mongoDeploy::ReplicaSet rs) {
+	vector<mongoDeploy::MongoD> active = rs.activeReplicas();
+	for (unsigned i = 0; i < active.size(); i++)
+		if (memberState (rs, mongoDeploy::hostPortString (active[i])) == 2) return active[i];
+	throw runtime_error ("No secondary to seed new member from in " + rs.name());
+}
+
+/** Shell command run before mongod to fill its dbpath with a copy of src's data files: reflink/copy on same host, rsync over ssh from another host (relative dbpaths are taken relative to the login directory there) */
+static string seedSetup (remote::Host host, string path, mongoDeploy::Process src) {
+	string srcHost = remote::hostPort(src.host).hostname;
+	string srcPath = * program::lookup ("dbpath", mongoDeploy::programOptions (src));
+	stringstream ss;
+	ss << "rm -rf " << path << " && mkdir -p " << path << " && ";
+	if (srcHost == remote::hostPort(host).hostname) ss << "cp -a --reflink=auto " << srcPath << "/. " << path;
+	else ss << "rsync -a " << srcHost << ":" << srcPath << "/ " << path;
+	ss << " && rm -f " << path << "/mongod.lock";
+	return ss.str();
+}
+
+/** Start mongod with dbpath copied from a secondary while that secondary is fsync-locked, so the new member only has to catch up on the oplog */
+static mongoDeploy::MongoD startSeededMongoD (mongoDeploy::ReplicaSet rs, remote::Host host, program::Options options) {
+	mongoDeploy::MongoD src = seedSource (rs);
+	mongoDeploy::Connection c = mongoDeploy::connectionPool() .get (mongoDeploy::hostPortString (src));
+	mongo::BSONObj info;
+	if (! c->runCommand ("admin", BSON ("fsync" << 1 << "lock" << 1), info)) throw runtime_error ("fsync lock failed: " + info.toString());
+	try {
+		program::Options opts = mongoDOptions (host, options);
+		mongoDeploy::MongoD proc = mongoDeploy::launch (host, seedSetup (host, * program::lookup ("dbpath", opts), src), mongoDeploy::placement() .wrap (remote::hostPort(host).hostname) + "mongod", opts);
+		mongoDeploy::waitConnect (proc, mongoDeploy::Backoff (24 * 3600 * 1000, 100, 2000));  // copy finished once mongod is up
+		c->findOne ("admin.$cmd.sys.unlock", mongo::BSONObj());
+		return proc;
+	} catch (...) {
+		c->findOne ("admin.$cmd.sys.unlock", mongo::BSONObj());
+		throw;
+	}
 }
 
-/** Start mongod and add it to replica set */
-void mongoDeploy::ReplicaSet::addStartReplica (remote::Host host, RsMemberSpec memberSpec) {
+/** Start mongod and add it to replica set. If seedFromSnapshot, its dbpath is copied from a secondary first. Wait until it is SECONDARY (or ARBITER) and return millis taken since start; also recorded in readyTimes */
+unsigned mongoDeploy::ReplicaSet::addStartReplica (remote::Host host, RsMemberSpec memberSpec, bool seedFromSnapshot, Backoff syncBackoff) {
+	Retry r (syncBackoff);
 	program::Options options;
 	options.push_back (make_pair ("replSet", name()));
-	MongoD proc = startMongoD (host, program::merge (options, memberSpec.opts));
+	program::Options opts = program::merge (options, memberSpec.opts);
+	MongoD proc = seedFromSnapshot ? startSeededMongoD (*this, host, opts) : launchMongoD (host, opts, isArbiter (memberSpec));
 	waitConnect (proc);
 	addReplica (*this, proc, memberSpec.memberConfig);
+	replicas.push_back (proc);
+	memberSpecs.push_back (memberSpec);
+	string hostPort = hostPortString (proc);
+	while (true) {
+		int state = -1;
+		try {state = memberState (*this, hostPort);} catch (exception& e) {}
+		if (state == 2 || state == 7) break;
+		if (! r.sleep()) throw runtime_error (hostPort + " did not become SECONDARY, state " + to_string (state));
+	}
+	recordReady (hostPort + " SECONDARY", r);
+	return r.elapsedMillis();
 }
 
-/** Remove i'th replica and stop it */
-void removeStopReplica (unsigned i) {
-	throw "TODO removeStopReplica";
+/** Remove i'th replica from replica set config and stop it. If it is primary it is stepped down first */
+void mongoDeploy::ReplicaSet::removeStopReplica (unsigned i) {
+	if (i >= replicas.size()) throw runtime_error ("no replica " + to_string (i) + " in " + name());
+	string hostPort = hostPortString (replicas[i]);
+	if (memberState (*this, hostPort) == 1) {
+		try {
+			mongo::BSONObj info;
+			connectionPool() .get (hostPort) ->runCommand ("admin", BSON ("replSetStepDown" << 60), info);
+		} catch (exception& e) {}  // primary drops connections when stepping down
+		waitForGoodReplStatus (connectionPool() .get (hostPort), name());
+	}
+	mongo::BSONObj cfg = replSetConfig (*this);
+	vector<mongo::BSONElement> ms = cfg.getField("members").Array();
+	mongo::BSONArrayBuilder members;
+	for (unsigned j = 0; j < ms.size(); j++)
+		if (ms[j].Obj().getStringField ("host") != hostPort) members.append (ms[j].Obj());
+	reconfig (*this, cfg, members.arr());
+	MongoD proc = replicas[i];
+	replicas.erase (replicas.begin() + i);
+	memberSpecs.erase (memberSpecs.begin() + i);
+	stopProcess (proc);
 }
 
 /** Shard cluster **/
 
 /** Start config mongoD on each host. 1 or 3 hosts expected */
 mongoDeploy::ConfigSet mongoDeploy::startConfigSet (vector<remote::Host> hosts, program::Options opts) {
-	vector<MongoD> procs;
-	for (unsigned i = 0; i < hosts.size(); i++) procs.push_back (startMongoD (hosts[i], opts));
-	for (unsigned i = 0; i < procs.size(); i++) waitConnect (procs[i]);
+	vector< boost::function0<MongoD> > launches;
+	for (unsigned i = 0; i < hosts.size(); i++) launches.push_back (boost::bind (startMongoD, hosts[i], opts));
+	vector<MongoD> procs = runAll (concurrentStart, launches);
+	probeAll (procs);
 	return ConfigSet (procs);
 }
 
@@ -200,37 +555,44 @@ program::Options mongoDeploy::defaultMongoS;
  * unique values generated for dbpath and port options if not already supplied +.
  * defaultMongoS where not already supplied. */
 mongoDeploy::MongoS mongoDeploy::startMongoS (remote::Host host, ConfigSet cs, program::Options options) {
+	program::Options given = program::merge (defaultMongoS, options);
 	program::Options config;
-	config.push_back (make_pair (string ("port"), to_string (27100 + (++ nextDbPath))));
+	if (! program::lookup ("port", given))
+		config.push_back (make_pair (string ("port"), to_string (allocator() .allocPort (remote::hostPort(host).hostname))));
 	config.push_back (make_pair (string ("configdb"), concat (intersperse (string(","), fmap (hostPortString, cs.cfgServers)))));
-	program::Options config1 = program::merge (config, defaultMongoS);
-	program::Options config2 = program::merge (config1, options);  //user options have precedence
-	program::Program program;
-	program.executable = "mongos";
-	program.options = config2;
-	return remote::launch (program, host);
+	program::Options config2 = program::merge (config, given);  //user options have precedence
+	Span span ("launch mongos", remote::hostPort(host).hostname + ":" + * program::lookup ("port", config2));
+	return launch (host, "", placement() .wrap (remote::hostPort(host).hostname) + "mongos", config2);
 }
 
 /** Start empty shard set with given config server specs and router (mongos) specs */
 mongoDeploy::ShardSet mongoDeploy::startShardSet (vector<remote::Host> cfgHosts, vector<remote::Host> routerHosts, program::Options cfgOpts, program::Options routerOpts) {
 	ConfigSet cs = startConfigSet (cfgHosts, cfgOpts);
 	boost::function1<MongoS,remote::Host> f = boost::bind (startMongoS, _1, cs, routerOpts);
-	vector<MongoS> rs = fmap (f, routerHosts);
-	for (unsigned i = 0; i < rs.size(); i++) waitConnect (rs[i]);
+	vector< boost::function0<MongoS> > launches;
+	for (unsigned i = 0; i < routerHosts.size(); i++) launches.push_back (boost::bind (f, routerHosts[i]));
+	vector<MongoS> rs = runAll (concurrentStart, launches);
+	probeAll (rs);
 	return ShardSet (cs, rs);
 }
 
+/** All processes of shard set: config servers, routers, then replicas of each shard */
+vector<mongoDeploy::Process> mongoDeploy::processes (ShardSet s) {
+	vector<Process> procs = s.configSet.cfgServers;
+	procs.insert (procs.end(), s.routers.begin(), s.routers.end());
+	for (unsigned i = 0; i < s.shards.size(); i++)
+		procs.insert (procs.end(), s.shards[i].replicas.begin(), s.shards[i].replicas.end());
+	return procs;
+}
+
 static void addShard (mongoDeploy::ShardSet& s, mongoDeploy::ReplicaSet r) {
-	mongo::DBClientConnection c;
-	c.connect (mongoDeploy::hostPortString (s.routers[0]));
-    mongo::BSONObj info;
-    mongo::BSONObj cmd = BSON ("addshard" << r.nameActiveHosts());
-    cout << cmd << " -> " << endl;
-    c.runCommand ("admin", cmd, info);
-    cout << " " << info << endl;
-    c.runCommand ("admin", BSON ("listshards" << 1), info);
-    cout << "listshards -> " << info << endl;
-    s.shards.push_back (r);
+	mongoDeploy::Connection c = s.router();
+	mongo::BSONObj info;
+	mongo::BSONObj cmd = BSON ("addshard" << r.nameActiveHosts());
+	mongoDeploy::Span span ("addshard", mongoDeploy::spanning() ? cmd.toString() : "");
+	c->runCommand ("admin", cmd, info);
+	if (mongoDeploy::spanning()) span.outcome (info.toString());
+	s.shards.push_back (r);
 }
 
 /** Start replica set of given specs on given hosts, and add it as another shard */
@@ -239,41 +601,227 @@ void mongoDeploy::ShardSet::addStartShard (vector<remote::Host> hosts, vector<Rs
 	addShard (*this, r);
 }
 
-/** Remove i'th shard and stop it */
-void mongoDeploy::ShardSet::removeStopShard (unsigned i) {
-	throw "TODO removeStopShard";
+/** Start replica sets of given specs, concurrently if concurrentStart, and add each as another shard. Shards are added in spec order once all are up */
+void mongoDeploy::ShardSet::addStartShards (vector<ReplicaSetSpec> specs) {
+	vector<ReplicaSet> rs = startReplicaSets (specs);
+	for (unsigned i = 0; i < rs.size(); i++) addShard (*this, rs[i]);
+}
+
+/** Data size of user databases on replica set, in bytes */
+static double dataBytes (mongoDeploy::ReplicaSet rs) {
+	mongoDeploy::Connection c = rs.primary();
+	mongo::BSONObj info;
+	c->runCommand ("admin", BSON ("listDatabases" << 1), info);
+	double bytes = 0;
+	vector<mongo::BSONElement> dbs = info.getField("databases").Array();
+	for (unsigned i = 0; i < dbs.size(); i++) {
+		string db = dbs[i].Obj().getStringField ("name");
+		if (db == "local" || db == "admin" || db == "config") continue;
+		mongo::BSONObj stats;
+		c->runCommand (db, BSON ("dbStats" << 1), stats);
+		bytes += stats.getField("dataSize").number();
+	}
+	return bytes;
+}
+
+/** Stop or resume the balancer of the cluster behind router connection */
+void mongoDeploy::setBalancerStopped (Connection c, bool stopped) {
+	c->update ("config.settings", QUERY ("_id" << "balancer"), BSON ("$set" << BSON ("stopped" << stopped)), true);
+}
+
+/** Drain i'th shard with removeshard, polling progress, then stop its processes and remove it from shards. Databases whose primary is the shard are moved to the next shard once its chunks are gone */
+mongoDeploy::DrainProgress mongoDeploy::ShardSet::removeStopShard (unsigned i, DrainOptions opts) {
+	if (i >= shards.size()) throw runtime_error ("no shard " + to_string (i));
+	if (shards.size() == 1) throw runtime_error ("can't remove last shard");
+	ReplicaSet rs = shards[i];
+	DrainProgress p (rs.name());
+	Connection c = router();
+	p.chunksStart = p.chunksRemaining = c->count ("config.chunks", BSON ("shard" << p.shard));
+	double bytesPerChunk = p.chunksStart > 0 ? dataBytes (rs) / p.chunksStart : 0;
+	boost::posix_time::ptime start = now();
+	bool throttled = false;
+	mongo::BSONObj info;
+	while (true) {
+		c = router();
+		if (! c->runCommand ("admin", BSON ("removeshard" << p.shard), info)) {
+			if (throttled) setBalancerStopped (c, false);
+			throw runtime_error ("removeshard failed: " + info.toString());
+		}
+		if (string (info.getStringField ("state")) == "completed") break;
+		if (info.hasField ("remaining")) {
+			p.chunksRemaining = info.getObjectField("remaining").getIntField ("chunks");
+			p.dbsRemaining = info.getObjectField("remaining").getIntField ("dbs");
+		}
+		p.elapsedMillis = (now() - start) .total_milliseconds();
+		double drainedMb = (p.chunksStart - p.chunksRemaining) * bytesPerChunk / (1 << 20);
+		p.mbPerSec = p.elapsedMillis > 0 ? drainedMb * 1000 / p.elapsedMillis : 0;
+		p.etaSecs = p.chunksStart > p.chunksRemaining ? (unsigned) ((double) p.elapsedMillis / (p.chunksStart - p.chunksRemaining) * p.chunksRemaining / 1000) : 0;
+		if (opts.onProgress) opts.onProgress (p);
+		if (opts.maxMbPerSec > 0 && (p.mbPerSec > opts.maxMbPerSec) != throttled) {
+			throttled = ! throttled;
+			setBalancerStopped (c, throttled);
+		}
+		if (p.chunksRemaining == 0 && p.dbsRemaining > 0 && ! opts.movePrimaries) {  // removeshard would never complete
+			if (throttled) setBalancerStopped (c, false);
+			throw runtime_error ("shard " + p.shard + " is drained but still primary for " + to_string (p.dbsRemaining) + " databases and movePrimaries is off");
+		}
+		if (p.chunksRemaining == 0 && p.dbsRemaining > 0) {
+			string to = shards [(i + 1) % shards.size()] .name();
+			auto_ptr<mongo::DBClientCursor> dbs = c->query ("config.databases", QUERY ("primary" << p.shard));
+			while (dbs->more())
+				adminCommand (c, BSON ("movePrimary" << dbs->next().getStringField ("_id") << "to" << to));
+		}
+		boost::this_thread::sleep (boost::posix_time::milliseconds (opts.pollMillis));
+	}
+	if (throttled) setBalancerStopped (c, false);
+	p.chunksRemaining = p.dbsRemaining = 0;
+	p.elapsedMillis = (now() - start) .total_milliseconds();
+	p.etaSecs = 0;
+	shards.erase (shards.begin() + i);
+	stopProcesses (rs.replicas);
+	return p;
 }
 
 /** Start mongos and add it to available routers */
 void mongoDeploy::ShardSet::addStartRouter (remote::Host host, program::Options opts) {
-	throw "TODO addStartRouter";
+	MongoS r = startMongoS (host, configSet, opts);
+	waitConnect (r);
+	routers.push_back (r);
 }
 
 /** Remove i'th router from list and stop it */
 void mongoDeploy::ShardSet::removeStopRouter (unsigned i) {
-	throw "TODO remoteStopRouter";
+	if (i >= routers.size()) throw runtime_error ("no router " + to_string (i));
+	if (routers.size() == 1) throw runtime_error ("can't remove last router");
+	MongoS r = routers[i];
+	routers.erase (routers.begin() + i);
+	stopProcess (r);
+}
+
+/** Connection to a router chosen by routerSelector(), failing over if one is down */
+mongoDeploy::Connection mongoDeploy::ShardSet::router () {
+	return routerSelector() .connect (routers);
 }
 
 /** Enable sharding on given database */
 void mongoDeploy::shardDatabase (string mongoSHostPort, string database) {
 	using namespace mongo;
 	BSONObj info;
-	DBClientConnection c;
-	c.connect (mongoSHostPort);
+	Connection c = connectionPool() .get (mongoSHostPort);
 	BSONObj cmd = BSON ("enablesharding" << database);
-	cout << cmd << " -> " << endl;
-	c.runCommand ("admin", cmd, info);
-	cout << info << endl;
+	Span span ("admin command", spanning() ? cmd.toString() : "");
+	c->runCommand ("admin", cmd, info);
+	if (spanning()) span.outcome (info.toString());
 }
 
 /** Shard collection on key */
 void mongoDeploy::shardCollection (string mongoSHostPort, string fullCollection, mongo::BSONObj shardKey) {
 	using namespace mongo;
 	BSONObj info;
-	DBClientConnection c;
-	c.connect (mongoSHostPort);
+	Connection c = connectionPool() .get (mongoSHostPort);
 	BSONObj cmd = BSON ("shardcollection" << fullCollection << "key" << shardKey);
-	cout << cmd << " -> " << endl;
-	c.runCommand ("admin", cmd, info);
-	cout << info << endl;
+	Span span ("admin command", spanning() ? cmd.toString() : "");
+	c->runCommand ("admin", cmd, info);
+	if (spanning()) span.outcome (info.toString());
+}
+
+/** Orders shard key values by shard key pattern */
+struct KeyLess {
+	mongo::BSONObj shardKey;
+	KeyLess (mongo::BSONObj shardKey) : shardKey(shardKey) {}
+	bool operator() (const mongo::BSONObj& a, const mongo::BSONObj& b) const {return a.woCompare (b, shardKey, false) < 0;}
+};
+
+/** Shard key values splitting sample (documents or keys) into numChunks roughly equal ranges */
+vector<mongo::BSONObj> mongoDeploy::splitPoints (mongo::BSONObj shardKey, vector<mongo::BSONObj> sample, unsigned numChunks) {
+	vector<mongo::BSONObj> keys;
+	for (unsigned i = 0; i < sample.size(); i++) keys.push_back (sample[i] .extractFields (shardKey, true) .getOwned());
+	sort (keys.begin(), keys.end(), KeyLess (shardKey));
+	vector<mongo::BSONObj> points;
+	for (unsigned k = 1; k < numChunks && ! keys.empty(); k++) {
+		mongo::BSONObj p = keys [k * keys.size() / numChunks];
+		if (points.empty() || KeyLess (shardKey) (points.back(), p)) points.push_back (p);  // skip duplicates
+	}
+	return points;
+}
+
+/** Split points evenly spaced over numeric range [min, max) of single-field shard key */
+vector<mongo::BSONObj> mongoDeploy::splitPoints (mongo::BSONObj shardKey, double min, double max, unsigned numChunks) {
+	string field = shardKey.firstElement().fieldName();
+	vector<mongo::BSONObj> points;
+	for (unsigned k = 1; k < numChunks; k++) points.push_back (BSON (field << min + k * (max - min) / numChunks));
+	return points;
+}
+
+/** Shard empty collection on key, split it at given points, and move resulting chunks round-robin across shard set's shards so load is spread before the first insert */
+void mongoDeploy::shardCollectionPresplit (ShardSet& s, string fullCollection, mongo::BSONObj shardKey, vector<mongo::BSONObj> points) {
+	if (s.shards.empty()) throw runtime_error ("no shards to distribute " + fullCollection + " over");
+	Connection c = s.router();
+	adminCommand (c, BSON ("shardcollection" << fullCollection << "key" << shardKey));
+	for (unsigned i = 0; i < points.size(); i++)
+		adminCommand (c, BSON ("split" << fullCollection << "middle" << points[i]));
+	// All chunks start on the database's primary shard. Rotate assignment so the first (MinKey) chunk stays there
+	string database = fullCollection.substr (0, fullCollection.find ('.'));
+	string primary = c->findOne ("config.databases", BSON ("_id" << database)) .getStringField ("primary");
+	unsigned p = 0;
+	for (unsigned i = 0; i < s.shards.size(); i++) if (s.shards[i].name() == primary) p = i;
+	for (unsigned i = 0; i < points.size(); i++) {
+		string to = s.shards [(p + i + 1) % s.shards.size()] .name();
+		if (to == primary) continue;
+		adminCommand (c, BSON ("moveChunk" << fullCollection << "find" << points[i] << "to" << to));
+	}
+}
+
+/* Serialization */
+
+mongoDeploy::BsonArena::~BsonArena () {
+	for (unsigned i = 0; i < chunks.size(); i++) free (chunks[i]);
+}
+
+static unsigned long bsonObjects, bsonAllocations, bsonBytes;
+
+char* mongoDeploy::BsonArena::alloc (unsigned n) {
+	if (n > left) {
+		unsigned size = max (n, chunkSize);
+		char* chunk = (char*) malloc (size);
+		if (! chunk) throw bad_alloc();
+		__sync_fetch_and_add (&bsonAllocations, 1);
+		chunks.push_back (chunk);
+		next = chunk;
+		left = size;
+	}
+	char* p = next;
+	next += n;
+	left -= n;
+	return p;
+}
+
+static void noCleanup (mongoDeploy::BsonArena*) {}  // arena is owned by its creator, not the thread
+
+static boost::thread_specific_ptr<mongoDeploy::BsonArena> currentArena (noCleanup);
+
+mongoDeploy::BsonArenaScope::BsonArenaScope (BsonArena& arena) : prev(currentArena.get()) {
+	currentArena.reset (&arena);}
+
+mongoDeploy::BsonArenaScope::~BsonArenaScope () {
+	currentArena.reset (prev);}
+
+mongoDeploy::BsonLoadStats mongoDeploy::bsonLoadStats () {
+	BsonLoadStats s;
+	s.objects = bsonObjects;
+	s.allocations = bsonAllocations;
+	s.bytes = bsonBytes;
+	return s;
+}
+
+/** Buffer of n bytes for a BSON object being loaded: from this thread's current arena if any (second = false), else malloc'ed for the object to own (second = true) */
+pair<char*,bool> mongoDeploy::bsonLoadBuffer (unsigned n) {
+	__sync_fetch_and_add (&bsonObjects, 1);
+	__sync_fetch_and_add (&bsonBytes, n);
+	BsonArena* arena = currentArena.get();
+	if (arena) return make_pair (arena->alloc (n), false);
+	char* data = (char*) malloc (n);  // BSONObj frees owned data with free()
+	if (! data) throw bad_alloc();
+	__sync_fetch_and_add (&bsonAllocations, 1);
+	return make_pair (data, true);
 }
@@ -8,20 +8,69 @@
 #include <10remote/remote.h>
 #include <10remote/process.h>
 #include <cassert>
+#include <boost/date_time/posix_time/posix_time.hpp>
+#include "connectionPool.h"
+#include "process.h"
 
 namespace mongoDeploy {
 
+/** Launch and probe the processes of a set concurrently (default). Set false to bring them up one at a time */
+extern bool concurrentStart;
+
 /** Connection **/
 
 /** Host and port of a mongoD/S process */
-std::string hostPortString (remote::Process mongoProcess);
-mongo::HostAndPort hostAndPort (remote::Process mongoProcess);
+std::string hostPortString (Process mongoProcess);
+mongo::HostAndPort hostAndPort (Process mongoProcess);
+
+/** Current time (UTC), for timing deployment steps */
+inline boost::posix_time::ptime now () {return boost::posix_time::microsec_clock::universal_time();}
+
+/** Readiness probe schedule: first retry after initialMillis, growing by factor each retry up to maxMillis between retries. Give up after deadlineMillis */
+struct Backoff {
+	unsigned deadlineMillis;
+	unsigned initialMillis;
+	unsigned maxMillis;
+	double factor;
+	explicit Backoff (unsigned deadlineMillis = 60000, unsigned initialMillis = 5, unsigned maxMillis = 500, double factor = 2) :
+		deadlineMillis(deadlineMillis), initialMillis(initialMillis), maxMillis(maxMillis), factor(factor) {}
+};
 
-typedef boost::shared_ptr<mongo::DBClientConnection> Connection;
+/** Backoff used when none supplied (60 sec deadline, 5ms to 500ms between retries) */
+extern Backoff defaultBackoff;
+
+/** Retry loop following a Backoff schedule, eg. `Retry r (b); while (true) try {return f();} catch (exception& e) {if (! r.sleep()) throw;}` */
+class Retry {
+	Backoff backoff;
+	boost::posix_time::ptime start;
+	unsigned delayMillis;
+public:
+	unsigned attempts;
+	Retry (Backoff);
+	/** Sleep until next attempt. Return false without sleeping if deadline would pass */
+	bool sleep ();
+	/** Millis since Retry was created */
+	unsigned elapsedMillis ();
+};
+
+/** Time a process or replica set took to become ready (reachable / good replica status) */
+struct ReadyTime {
+	std::string what;  // hostPort or replica set name
+	unsigned millis;
+	unsigned attempts;
+	ReadyTime (std::string what, unsigned millis, unsigned attempts) : what(what), millis(millis), attempts(attempts) {}
+};
 
-/** Try to connect every 2 secs until successful. Give up after maxSecs (60 secs by default) */
-Connection waitConnect (std::string hostPort, unsigned maxSecs = 60);
-Connection waitConnect (remote::Process mongoProcess, unsigned maxSecs = 60);
+/** Most ready times kept. Older ones are dropped as new ones come in (10000 by default) */
+extern unsigned readyTimesCapacity;
+
+/** Ready times recorded by waitConnect and startReplicaSet, oldest first, at most readyTimesCapacity */
+std::vector<ReadyTime> readyTimes ();
+void clearReadyTimes ();
+
+/** Try to get connection from connectionPool following backoff schedule until successful. Raise last connect error after deadline. Time taken is recorded in readyTimes */
+Connection waitConnect (std::string hostPort, Backoff = defaultBackoff);
+Connection waitConnect (Process mongoProcess, Backoff = defaultBackoff);
 
 /** MongoD **/
 
@@ -30,13 +79,49 @@ extern std::string mongoDbPathPrefix;
 /** Default MongoD config is merged with user supplied config. User config options take precedence */
 extern program::Options defaultMongoD;
 
-typedef remote::Process MongoD;
+/** How startMongoD prepares a fresh dbpath */
+enum DbPathInit {
+	EmptyDbPath,  // remove and recreate empty directory (default). mongod preallocates its files from scratch
+	ReflinkTemplate,  // copy-on-write clone (plain copy where filesystem lacks reflinks) of a template dbpath made once per host, mongod version and file-layout options
+	CopyTemplate  // plain copy of the template
+};
+extern DbPathInit dbPathInit;
+
+typedef Process MongoD;
 
 /** Start mongod program with given options +
  * unique values generated for dbpath and port options if not already supplied +
- * defaultMongoD options where not already supplied. */
+ * defaultMongoD options where not already supplied.
+ * Port and dbpath come from allocator(), see allocator.h. CPUs and NUMA memory come from placement(), see placement.h */
 MongoD startMongoD (remote::Host, program::Options = program::Options());
 
+/** mongod spawned directly by this process with fork/exec, no 10remote listener or RPC involved. See localProcess.h */
+typedef lprocess::Process LocalMongoD;
+
+/** startMongoD on this machine without 10remote, with the same generated options and dbpath setup */
+LocalMongoD startLocalMongoD (program::Options = program::Options());
+
+/** Return process's port and dbpath to the allocator for reuse. Call after stopping it */
+void releaseProcess (Process);
+
+/** Terminate process (mongo shuts down cleanly on SIGTERM) and wait until its port is closed, unwatching it first in any Supervisor. Its port and dbpath stay reserved, eg. for restarting it */
+void terminate (Process, Backoff = defaultBackoff);
+
+/** Terminate process and release its port and dbpath for reuse */
+void stopProcess (Process, Backoff = defaultBackoff);
+/** stopProcess each process, concurrently */
+void stopProcesses (std::vector<Process>);
+
+/** Counters behind generated dbpaths, ports and replica set names. Saved with topology snapshots so a restarted driver continues numbering where the old one left off */
+struct Counters {
+	unsigned long nextDbPath;
+	unsigned long nextReplicaSetId;
+	Counters () : nextDbPath(0), nextReplicaSetId(0) {}
+};
+Counters counters ();
+/** Advance counters to at least the given values */
+void advanceCounters (Counters);
+
 //inline bool isMongoD (remote::Process p) {return p.process.program.executable == "mongod";}
 
 /** Replica set **/
@@ -62,15 +147,30 @@ public:
 	std::vector<MongoD> activeReplicas();
 	/** Replica-set name "/" comma-separated hostPorts of active members only */
 	std::string nameActiveHosts();
-	/** Start mongod and add it to replica set */
-	void addStartReplica (remote::Host, RsMemberSpec);
-	/** Remove i'th replica and stop it */
+	/** Pooled connection to current primary. Raise if there is none */
+	Connection primary();
+	/** Start mongod and add it to replica set via replSetReconfig. If seedFromSnapshot, its dbpath is first copied from a secondary (fsync-locked meanwhile) so it only catches up on the oplog instead of a full initial sync. Wait until it is SECONDARY (or ARBITER) and return millis taken; also recorded in readyTimes */
+	unsigned addStartReplica (remote::Host, RsMemberSpec, bool seedFromSnapshot = false, Backoff syncBackoff = Backoff (24 * 3600 * 1000, 100, 5000));
+	/** Remove i'th replica from replica set config and stop it. A primary is stepped down first */
 	void removeStopReplica (unsigned i);
 };
 
 /** Start replica set on given servers with given config options + generated 'replSet' and options filled in by 'startMongoD' (if not already supplied). Set-wide rsSettings can also be supplied. See http://www.mongodb.org/display/DOCS/Replica+Set+Configuration for config details. */
 ReplicaSet startReplicaSet (std::vector<remote::Host>, std::vector<RsMemberSpec>, mongo::BSONObj rsSettings = mongo::BSONObj());
 
+/** Hosts and member specs of a replica set to start, plus set-wide rsSettings */
+struct ReplicaSetSpec {
+	std::vector<remote::Host> hosts;
+	std::vector<RsMemberSpec> memberSpecs;
+	mongo::BSONObj rsSettings;
+	ReplicaSetSpec (std::vector<remote::Host> hosts, std::vector<RsMemberSpec> memberSpecs, mongo::BSONObj rsSettings = mongo::BSONObj()) : hosts(hosts), memberSpecs(memberSpecs), rsSettings(rsSettings)
+		{assert (hosts.size() == memberSpecs.size());}
+	ReplicaSetSpec () {}
+};
+
+/** Start each replica set, concurrently if concurrentStart */
+std::vector<ReplicaSet> startReplicaSets (std::vector<ReplicaSetSpec>);
+
 /** Shard cluster **/
 
 /** Sharding config servers */
@@ -87,13 +187,34 @@ ConfigSet startConfigSet (std::vector<remote::Host>, program::Options = program:
 /** Default MongoS config is merged with user supplied config. User config options take precedence */
 extern program::Options defaultMongoS;
 
-typedef remote::Process MongoS;
+typedef Process MongoS;
 
 /** Start mongos program with given options +
  * unique values generated for dbpath and port options if not already supplied +
  * defaultMongoS options where not already supplied. */
 MongoS startMongoS (remote::Host, ConfigSet, program::Options = program::Options());
 
+/** Progress of a shard being drained by removeStopShard */
+struct DrainProgress {
+	std::string shard;
+	unsigned chunksStart;
+	unsigned chunksRemaining;
+	unsigned dbsRemaining;  // databases still having this shard as primary
+	double mbPerSec;  // drain rate so far, estimated from shard's data size over its chunk count at start
+	unsigned etaSecs;  // time left at current chunk rate
+	unsigned elapsedMillis;
+	DrainProgress (std::string shard) : shard(shard), chunksStart(0), chunksRemaining(0), dbsRemaining(0), mbPerSec(0), etaSecs(0), elapsedMillis(0) {}
+};
+
+/** How removeStopShard drains */
+struct DrainOptions {
+	unsigned pollMillis;  // between removeshard progress checks (2 secs by default)
+	double maxMbPerSec;  // pause balancer while drain rate is above this. 0 (default) means unthrottled
+	bool movePrimaries;  // move databases whose primary is the shard to another shard (true by default). If off, removeStopShard raises once chunks are drained while such databases remain
+	boost::function1<void, DrainProgress> onProgress;  // called after each progress check
+	DrainOptions (unsigned pollMillis = 2000, double maxMbPerSec = 0, bool movePrimaries = true) : pollMillis(pollMillis), maxMbPerSec(maxMbPerSec), movePrimaries(movePrimaries) {}
+};
+
 /** A full sharding deployment with routers (mongos), config servers (ConfigSet), and ReplicaSet shards */
 class ShardSet {
 public:
@@ -105,14 +226,24 @@ public:
 	ShardSet () {}  // for serialization
 	/** Start replica set of given specs on given hosts, and add it as another shard */
 	void addStartShard (std::vector<remote::Host>, std::vector<RsMemberSpec>, mongo::BSONObj rsSettings = mongo::BSONObj());
-	/** Remove i'th shard and stop it */
-	void removeStopShard (unsigned i);
+	/** Start replica sets of given specs, concurrently if concurrentStart, and add each as another shard */
+	void addStartShards (std::vector<ReplicaSetSpec>);
+	/** Drain i'th shard (removeshard), reporting progress to opts.onProgress, then stop its processes and remove it. Return final progress */
+	DrainProgress removeStopShard (unsigned i, DrainOptions opts = DrainOptions());
 	/** Start mongos and add it to available routers */
 	void addStartRouter (remote::Host, program::Options = program::Options());
-	/** Remove i'th router from list and stop it */
+	/** Remove i'th router from list and stop it. Last router can't be removed */
 	void removeStopRouter (unsigned i);
+	/** Connection to a router chosen by routerSelector() by load, failing over if one is down. See routers.h */
+	Connection router ();
 };
 
+/** Stop or resume the balancer of the cluster behind router connection */
+void setBalancerStopped (Connection mongoS, bool stopped);
+
+/** All processes of shard set: config servers, routers, then replicas of each shard */
+std::vector<Process> processes (ShardSet);
+
 /** Start empty shard set with given config server specs and router (mongos) specs */
 ShardSet startShardSet (std::vector<remote::Host> cfgHosts, std::vector<remote::Host> routerHosts, program::Options cfgOpts = program::Options(), program::Options routerOpts = program::Options());
 
@@ -124,12 +255,28 @@ inline void shardDatabase (MongoS mongoS, std::string database) {shardDatabase (
 void shardCollection (std::string mongoSHostPort, std::string fullCollection, mongo::BSONObj shardKey);
 inline void shardCollection (MongoS mongoS, std::string fullCollection, mongo::BSONObj shardKey) {shardCollection (hostPortString (mongoS), fullCollection, shardKey);}
 
+/** Shard key values splitting sample (documents or keys) into numChunks roughly equal ranges */
+std::vector<mongo::BSONObj> splitPoints (mongo::BSONObj shardKey, std::vector<mongo::BSONObj> sample, unsigned numChunks);
+/** Split points evenly spaced over numeric range [min, max) of single-field shard key */
+std::vector<mongo::BSONObj> splitPoints (mongo::BSONObj shardKey, double min, double max, unsigned numChunks);
+
+/** Shard empty collection on key, split it at given points, and move resulting chunks round-robin across shard set's shards so load is spread before the first insert */
+void shardCollectionPresplit (ShardSet&, std::string fullCollection, mongo::BSONObj shardKey, std::vector<mongo::BSONObj> splitPoints);
+
 }
 
 /* Printing */
 
 // #include <10util/util.h> // output vector
 
+inline std::ostream& operator<< (std::ostream& out, const mongoDeploy::ReadyTime& x) {
+	out << x.what << " ready in " << x.millis << "ms (" << x.attempts << " attempts)";
+	return out;}
+
+inline std::ostream& operator<< (std::ostream& out, const mongoDeploy::DrainProgress& x) {
+	out << "DrainProgress " << x.shard << " " << x.chunksRemaining << "/" << x.chunksStart << " chunks, " << x.dbsRemaining << " dbs left, " << x.mbPerSec << " MB/s, eta " << x.etaSecs << "s";
+	return out;}
+
 inline std::ostream& operator<< (std::ostream& out, const mongoDeploy::RsMemberSpec& x) {
 	out << "RsMemberSpec " << program::optionsString (x.opts) << " " << x.memberConfig;
 	return out;}
@@ -149,10 +296,49 @@ inline std::ostream& operator<< (std::ostream& out, const mongoDeploy::ShardSet&
 /* Serialization */
 
 #include <boost/serialization/split_free.hpp>
+#include <boost/serialization/string.hpp>
 #include <boost/serialization/utility.hpp>
 #include <boost/serialization/vector.hpp>
+#include <boost/noncopyable.hpp>
+#include <cstdlib>
 
 BOOST_SERIALIZATION_SPLIT_FREE (mongo::BSONObj)
+BOOST_SERIALIZATION_SPLIT_FREE (mongoDeploy::Process)
+
+namespace mongoDeploy {
+
+/** Storage for many BSON objects decoded together (eg. a large ShardSet), freed all at once when the arena is destroyed. Objects loaded into an arena do not own their data so the arena must outlive them (use getOwned() to keep one longer) */
+class BsonArena : boost::noncopyable {
+	std::vector<char*> chunks;
+	char* next;
+	unsigned left;
+public:
+	unsigned chunkSize;
+	BsonArena (unsigned chunkSize = 1 << 16) : next(0), left(0), chunkSize(chunkSize) {}
+	~BsonArena ();
+	char* alloc (unsigned n);
+};
+
+/** While in scope, BSON objects loaded on this thread are placed in arena */
+class BsonArenaScope : boost::noncopyable {
+	BsonArena* prev;
+public:
+	BsonArenaScope (BsonArena&);
+	~BsonArenaScope ();
+};
+
+/** Counts of BSON objects loaded and the buffers allocated for them (arena chunks included) */
+struct BsonLoadStats {
+	unsigned long objects;
+	unsigned long allocations;
+	unsigned long bytes;
+};
+BsonLoadStats bsonLoadStats ();
+
+/** Buffer of n bytes for a BSON object being loaded: from this thread's current arena if any (second = false), else malloc'ed for the object to own (second = true) */
+std::pair<char*,bool> bsonLoadBuffer (unsigned n);
+
+}
 
 namespace boost {
 namespace serialization {
@@ -166,10 +352,44 @@ template <class Archive> void save (Archive& ar, const mongo::BSONObj& x, const
 template <class Archive> void load (Archive& ar, mongo::BSONObj& x, const unsigned version) {
 	unsigned n;
 	ar >> n;
-	char* data = new char[n];
-	ar.load_binary (data, n);
-	x = mongo::BSONObj (data) .copy(); //TODO: create owned object directly on data (and don't delete data)
-	delete[] data;
+	std::pair<char*,bool> buf = mongoDeploy::bsonLoadBuffer (n);
+	try {
+		ar.load_binary (buf.first, n);
+	} catch (...) {
+		if (buf.second) free (buf.first);
+		throw;
+	}
+	x = mongo::BSONObj (buf.first, buf.second);  // adopts malloc'ed buffer, or borrows arena space
+}
+
+/** Saved as a kind tag (0 empty handle, 1 remote, 2 local) then the process. Local processes are saved by pid and reloaded with lprocess::adopt, since the loading process is not their parent */
+template <class Archive> void save (Archive& ar, const mongoDeploy::Process& x, const unsigned version) {
+	unsigned char kind = x.isLocal() ? 2 : x.launched() ? 1 : 0;
+	ar << kind;
+	if (kind == 2) {
+		pid_t pid = x.lproc.pid();
+		std::string executable = mongoDeploy::programExecutable (x);
+		program::Options options = mongoDeploy::programOptions (x);
+		ar << pid << executable << options;
+	} else if (kind == 1)
+		ar << *x.rproc;
+}
+
+template <class Archive> void load (Archive& ar, mongoDeploy::Process& x, const unsigned version) {
+	unsigned char kind;
+	ar >> kind;
+	if (kind == 2) {
+		pid_t pid;
+		std::string executable;
+		program::Options options;
+		ar >> pid >> executable >> options;
+		x = mongoDeploy::Process (lprocess::adopt (pid, executable, options));
+	} else if (kind == 1) {
+		remote::Process p;
+		ar >> p;
+		x = mongoDeploy::Process (p);
+	} else
+		x = mongoDeploy::Process();
 }
 
 template <class Archive> void serialize (Archive & ar, mongoDeploy::RsMemberSpec & x, const unsigned version) {
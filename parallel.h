@@ -0,0 +1,59 @@
+/* Run independent deployment steps concurrently */
+
+#pragma once
+
+#include <vector>
+#include <string>
+#include <stdexcept>
+#include <boost/optional.hpp>
+#include <boost/function.hpp>
+#include <boost/bind.hpp>
+#include <boost/thread.hpp>
+#include "allocator.h"
+
+namespace mongoDeploy {
+
+namespace detail {
+
+template <class T> void runInto (boost::function0<T> action, boost::optional<T>* result, boost::optional<std::string>* error, Allocator* allocator) {
+	if (allocator) {
+		AllocatorScope scope (*allocator);
+		runInto (action, result, error, (Allocator*) 0);
+		return;
+	}
+	try {*result = action();}
+	catch (std::exception& e) {*error = std::string (e.what());}
+	catch (const char* e) {*error = std::string (e);}
+	catch (...) {*error = std::string ("unknown exception");}
+}
+
+}
+
+/** Run each action in its own thread, in the caller's allocator scope, and return their results in order. Waits for all actions to finish, then raises the first failure if any */
+template <class T> std::vector<T> parallel (std::vector< boost::function0<T> > actions) {
+	std::vector< boost::optional<T> > results (actions.size());
+	std::vector< boost::optional<std::string> > errors (actions.size());
+	boost::thread_group threads;
+	for (unsigned i = 0; i < actions.size(); i++)
+		threads.create_thread (boost::bind (detail::runInto<T>, actions[i], &results[i], &errors[i], scopedAllocator()));
+	threads.join_all();
+	for (unsigned i = 0; i < errors.size(); i++)
+		if (errors[i]) throw std::runtime_error (*errors[i]);
+	std::vector<T> values;
+	for (unsigned i = 0; i < results.size(); i++) values.push_back (*results[i]);
+	return values;
+}
+
+/** Run each action in turn and return their results in order */
+template <class T> std::vector<T> serial (std::vector< boost::function0<T> > actions) {
+	std::vector<T> results;
+	for (unsigned i = 0; i < actions.size(); i++) results.push_back (actions[i]());
+	return results;
+}
+
+/** Run actions in parallel if concurrently, else serially */
+template <class T> std::vector<T> runAll (bool concurrently, std::vector< boost::function0<T> > actions) {
+	return concurrently ? parallel (actions) : serial (actions);
+}
+
+}
@@ -0,0 +1,118 @@
+/* */
+
+#include "placement.h"
+#include <fstream>
+#include <sstream>
+#include <set>
+#include <unistd.h>
+#include <boost/algorithm/string.hpp>
+#include <boost/lexical_cast.hpp>
+
+using namespace std;
+
+unsigned mongoDeploy::CpuLayout::cpus () const {
+	unsigned n = 0;
+	for (unsigned i = 0; i < nodes.size(); i++) n += nodes[i].size();
+	return n;
+}
+
+/** CPUs of kernel cpulist, eg. "0-3,8-11" */
+static vector<unsigned> parseCpuList (string list) {
+	vector<unsigned> cpus;
+	vector<string> ranges;
+	boost::trim (list);
+	if (list.empty()) return cpus;
+	boost::split (ranges, list, boost::is_any_of (","));
+	for (unsigned i = 0; i < ranges.size(); i++) {
+		vector<string> ends;
+		boost::split (ends, ranges[i], boost::is_any_of ("-"));
+		unsigned first = boost::lexical_cast<unsigned> (ends[0]), last = boost::lexical_cast<unsigned> (ends.back());
+		for (unsigned c = first; c <= last; c++) cpus.push_back (c);
+	}
+	return cpus;
+}
+
+/** Cpulist of cpus, eg. "0-3,8-11" */
+static string cpuList (vector<unsigned> cpus) {
+	stringstream ss;
+	for (unsigned i = 0; i < cpus.size(); ) {
+		unsigned j = i;
+		while (j + 1 < cpus.size() && cpus[j + 1] == cpus[j] + 1) j++;
+		ss << (i > 0 ? "," : "") << cpus[i];
+		if (j > i) ss << "-" << cpus[j];
+		i = j + 1;
+	}
+	return ss.str();
+}
+
+mongoDeploy::CpuLayout mongoDeploy::localCpuLayout () {
+	CpuLayout l;
+	for (unsigned node = 0; ; node++) {
+		ifstream in (("/sys/devices/system/node/node" + boost::lexical_cast<string> (node) + "/cpulist") .c_str());
+		string list;
+		if (! in || ! getline (in, list)) break;
+		l.nodes.push_back (parseCpuList (list));
+	}
+	if (l.cpus() == 0) {
+		l.nodes.assign (1, vector<unsigned>());
+		long n = sysconf (_SC_NPROCESSORS_ONLN);
+		for (long c = 0; c < max (n, 1L); c++) l.nodes[0].push_back (c);
+	}
+	return l;
+}
+
+void mongoDeploy::Placement::partition (string hostname, unsigned slots, bool arbiterCpu) {
+	boost::mutex::scoped_lock lock (mutex);
+	HostState& h = hosts[hostname];
+	h.slots = slots;
+	h.arbiterCpu = arbiterCpu;
+	h.next = 0;
+}
+
+void mongoDeploy::Placement::plan (vector<remote::Host> hostList, vector<remote::Host> arbiterHosts, unsigned spareSlots) {
+	map<string,unsigned> slots;
+	set<string> arbiters;
+	for (unsigned i = 0; i < hostList.size(); i++) slots [remote::hostPort(hostList[i]).hostname] ++;
+	for (unsigned i = 0; i < arbiterHosts.size(); i++) arbiters.insert (remote::hostPort(arbiterHosts[i]).hostname);
+	for (map<string,unsigned>::iterator it = slots.begin(); it != slots.end(); ++it) partition (it->first, it->second + spareSlots, arbiters.count (it->first));
+	for (set<string>::iterator it = arbiters.begin(); it != arbiters.end(); ++it) if (! slots.count (*it)) partition (*it, 1 + spareSlots, true);
+}
+
+void mongoDeploy::Placement::layout (string hostname, CpuLayout l) {
+	boost::mutex::scoped_lock lock (mutex);
+	hosts[hostname].layout = l;
+}
+
+/** numactl or taskset command confining to cpus, with memory bound to nodes (local if none) */
+static string pinCommand (vector<unsigned> cpus, set<unsigned> nodes, bool numactl) {
+	if (! numactl) return "taskset -c " + cpuList (cpus) + " ";
+	if (nodes.empty()) return "numactl --physcpubind=" + cpuList (cpus) + " --localalloc ";
+	return "numactl --physcpubind=" + cpuList (cpus) + " --membind=" + cpuList (vector<unsigned> (nodes.begin(), nodes.end())) + " ";
+}
+
+string mongoDeploy::Placement::wrap (string hostname, bool arbiter) {
+	static CpuLayout local = localCpuLayout();
+	boost::mutex::scoped_lock lock (mutex);
+	if (! hosts.count (hostname) || hosts[hostname].slots == 0) return "";
+	HostState& h = hosts[hostname];
+	CpuLayout l = h.layout ? *h.layout : local;
+	bool numactl = alwaysNumactl || l.nodes.size() > 1;
+	vector<unsigned> cpus, cpuNodes;
+	for (unsigned n = 0; n < l.nodes.size(); n++)
+		for (unsigned i = 0; i < l.nodes[n].size(); i++) {cpus.push_back (l.nodes[n][i]); cpuNodes.push_back (n);}
+	bool setAside = h.arbiterCpu && cpus.size() > 1;
+	if (arbiter) return pinCommand (vector<unsigned> (1, cpus.back()), set<unsigned>(), numactl);
+	unsigned usable = cpus.size() - (setAside ? 1 : 0);
+	if (h.next == h.slots) throw runtime_error ("all " + boost::lexical_cast<string> (h.slots) + " CPU slices of " + hostname + " are in use; plan it with spare slots");
+	unsigned slot = h.next++;
+	unsigned begin = slot * usable / h.slots, end = (slot + 1) * usable / h.slots;
+	if (end == begin) {begin = slot % usable; end = begin + 1;}  // more slots than CPUs: share
+	vector<unsigned> slice (cpus.begin() + begin, cpus.begin() + end);
+	set<unsigned> nodes (cpuNodes.begin() + begin, cpuNodes.begin() + end);
+	return pinCommand (slice, nodes, numactl);
+}
+
+mongoDeploy::Placement& mongoDeploy::placement () {
+	static Placement p;
+	return p;
+}
@@ -0,0 +1,54 @@
+/* Pin co-located mongo processes to disjoint CPU and NUMA memory partitions of their host */
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <map>
+#include <boost/optional.hpp>
+#include <boost/thread.hpp>
+#include <10remote/remote.h>
+
+namespace mongoDeploy {
+
+/** CPUs of a host grouped by NUMA node */
+struct CpuLayout {
+	std::vector< std::vector<unsigned> > nodes;
+	CpuLayout (std::vector< std::vector<unsigned> > nodes) : nodes(nodes) {}
+	CpuLayout () {}
+	unsigned cpus () const;
+};
+
+/** Layout of this machine per /sys/devices/system/node, else one node of all online CPUs */
+CpuLayout localCpuLayout ();
+
+/** Cuts each partitioned host's CPUs into equal slices, one per mongod/mongos launched on it, in NUMA node order so a slice spans as few nodes as possible. Processes are wrapped in numactl (CPUs plus memory bound to the slice's nodes) or, on single-node hosts, taskset. Arbiters share the host's last CPU, with memory local; partition can set it aside for them. Hosts not partitioned launch unpinned. Thread-safe */
+class Placement {
+public:
+	/** Use numactl even on single-node hosts (false by default) */
+	bool alwaysNumactl;
+	Placement () : alwaysNumactl(false) {}
+	/** Cut hostname's CPUs into slots slices, setting its last CPU aside for arbiters if arbiterCpu. 0 slots unpartitions it */
+	void partition (std::string hostname, unsigned slots, bool arbiterCpu = false);
+	/** Partition each host by how often it occurs in hosts, eg. once per non-arbiter of a deployment, plus spareSlots more for processes added later (addStartReplica, addStartRouter). Set a CPU aside where arbiterHosts has it */
+	void plan (std::vector<remote::Host> hosts, std::vector<remote::Host> arbiterHosts = std::vector<remote::Host>(), unsigned spareSlots = 0);
+	/** CPU layout assumed for hostname. Remote hosts are assumed to be like this machine unless set */
+	void layout (std::string hostname, CpuLayout);
+	/** Command prefixing the executable of the next process on hostname, eg. "numactl --physcpubind=0-3 --membind=0 ", or of an arbiter. Raise once all its slices are handed out, rather than pin two processes to one slice. Empty if hostname isn't partitioned */
+	std::string wrap (std::string hostname, bool arbiter = false);
+private:
+	struct HostState {
+		boost::optional<CpuLayout> layout;
+		unsigned slots;
+		bool arbiterCpu;
+		unsigned next;
+		HostState () : slots(0), arbiterCpu(false), next(0) {}
+	};
+	std::map<std::string, HostState> hosts;
+	boost::mutex mutex;
+};
+
+/** Placement used by startMongoD and startMongoS. Partitions no host until told to */
+Placement& placement ();
+
+}
@@ -0,0 +1,69 @@
+/* */
+
+#include "pool.h"
+#include "trace.h"
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/file.h>
+
+using namespace std;
+
+string mongoDeploy::processNamePrefix () {return "p" + to_string (getpid()) + "_";}
+
+/** Lock on block of ports starting at first, or -1 if another pool holds it */
+static int lockPortBlock (unsigned first) {
+	string path = "/tmp/mongoDeploy-ports-" + to_string (first) + ".lock";
+	int fd = open (path.c_str(), O_RDWR | O_CREAT, 0666);
+	if (fd < 0) throw runtime_error ("can't open " + path + ": " + strerror (errno));
+	if (flock (fd, LOCK_EX | LOCK_NB) == 0) return fd;
+	close (fd);
+	return -1;
+}
+
+mongoDeploy::PortRange::PortRange (unsigned from, unsigned count) : count(count) {
+	unsigned blocks = (count + Block - 1) / Block;
+	for (portBase = (from + Block - 1) / Block * Block; portBase + blocks * Block <= 65536; portBase += Block) {
+		for (unsigned b = 0; b < blocks; b++) {
+			int fd;
+			try {fd = lockPortBlock (portBase + b * Block);}
+			catch (exception&) {for (unsigned l = 0; l < locks.size(); l++) close (locks[l]); throw;}
+			if (fd < 0) break;
+			locks.push_back (fd);
+		}
+		if (locks.size() == blocks) return;
+		for (unsigned b = 0; b < locks.size(); b++) close (locks[b]);
+		locks.clear();
+	}
+	throw runtime_error ("no free range of " + to_string (count) + " ports from " + to_string (from));
+}
+
+mongoDeploy::PortRange::~PortRange () {
+	for (unsigned b = 0; b < locks.size(); b++) close (locks[b]);
+}
+
+/** Drop every database but admin, config and local through connection */
+static void dropUserDatabases (mongoDeploy::Connection c) {
+	list<string> dbs = c->getDatabaseNames();
+	for (list<string>::iterator it = dbs.begin(); it != dbs.end(); ++it)
+		if (*it != "admin" && *it != "config" && *it != "local") c->dropDatabase (*it);
+}
+
+/** Drop every user database through a router and resume the balancer */
+void mongoDeploy::resetCluster (ShardSet& s) {
+	Span span ("reset cluster", to_string (s.shards.size()) + " shards");
+	Connection c = s.router();
+	dropUserDatabases (c);
+	setBalancerStopped (c, false);
+}
+
+/** Drop every user database on the primary */
+void mongoDeploy::resetCluster (ReplicaSet& rs) {
+	Span span ("reset cluster", rs.name());
+	dropUserDatabases (rs.primary());
+}
+
+void mongoDeploy::stopCluster (ShardSet& s) {stopProcesses (processes (s));}
+
+void mongoDeploy::stopCluster (ReplicaSet& rs) {stopProcesses (rs.replicas);}
@@ -0,0 +1,179 @@
+/* Pool of isolated, pre-started clusters for running many test deployments in parallel on one box */
+
+#pragma once
+
+#include "mongoDeploy.h"
+#include "allocator.h"
+#include <stdexcept>
+#include <boost/noncopyable.hpp>
+#include <10util/util.h>
+
+namespace mongoDeploy {
+
+/** "p<pid>_": default pool name prefix, so pools of driver processes sharing a box get their own dbpaths and replica set names */
+std::string processNamePrefix ();
+
+/** Ports [portBase, portBase + count) claimed among driver processes on this box, by an flock on a lock file per block of PortRange::Block ports under /tmp. Held until destroyed or the process exits */
+class PortRange : boost::noncopyable {
+	std::vector<int> locks;
+public:
+	static const unsigned Block = 100;
+	unsigned portBase;
+	unsigned count;
+	/** Claim the first count ports at or after from (rounded up to a block) whose blocks no other pool holds. Raise if none are left */
+	PortRange (unsigned from, unsigned count);
+	~PortRange ();
+};
+
+/** Layout of a cluster pool. Cluster i gets its own claimed PortRange of portsPerCluster ports at or after portBase, dbpaths under dataRoot/<namePrefix>c<i>, and names prefixed <namePrefix>c<i>_. A cluster that fails to build is built again after rebuildMillis */
+struct ClusterPoolSpec {
+	unsigned size;  // clusters kept (4 by default)
+	unsigned portBase;  // 30000 by default, clear of allocator()'s default range
+	unsigned portsPerCluster;  // 100 by default
+	std::string dataRoot;  // "pool" by default, relative to the remote working directory
+	std::string namePrefix;  // processNamePrefix() by default. Pools in one driver process must differ in it or in dataRoot
+	unsigned rebuildMillis;  // 5 secs by default
+	ClusterPoolSpec (unsigned size = 4, unsigned portBase = 30000, unsigned portsPerCluster = 100, std::string dataRoot = "pool", std::string namePrefix = processNamePrefix(), unsigned rebuildMillis = 5000) :
+		size(size), portBase(portBase), portsPerCluster(portsPerCluster), dataRoot(dataRoot), namePrefix(namePrefix), rebuildMillis(rebuildMillis) {}
+};
+
+/** Drop every user database of cluster, making it like new. Raise if it is unreachable */
+void resetCluster (ShardSet&);
+void resetCluster (ReplicaSet&);
+
+/** Stop every process of cluster, releasing ports and dbpaths to allocator() */
+void stopCluster (ShardSet&);
+void stopCluster (ReplicaSet&);
+
+/** Keeps spec.size clusters (ShardSet or ReplicaSet) made by build, each from its own Allocator (see AllocatorScope), warm for checkout. All start building in the background on construction. A returned lease has its cluster reset in the background and put back; a cluster that fails to reset is stopped and built again, and one that fails to build is retried. Leases must be returned before the pool is destroyed. Thread-safe */
+template <class Cluster> class ClusterPool : boost::noncopyable {
+public:
+	/** Leased cluster. Goes back to the pool when the last copy is dropped */
+	typedef boost::shared_ptr<Cluster> Lease;
+	ClusterPool (boost::function0<Cluster> build, ClusterPoolSpec spec = ClusterPoolSpec()) : build(build), rebuildMillis(spec.rebuildMillis), closing(false) {
+		unsigned from = spec.portBase;
+		for (unsigned i = 0; i < spec.size; i++) {
+			boost::shared_ptr<Slot> slot (new Slot());
+			slot->ports.reset (new PortRange (from, spec.portsPerCluster));
+			from = slot->ports->portBase + spec.portsPerCluster;
+			slot->allocator.portBase = slot->ports->portBase;
+			slot->allocator.portCount = spec.portsPerCluster;
+			slot->allocator.namePrefix = spec.namePrefix + "c" + to_string (i) + "_";
+			slot->allocator.dataRoots.push_back (spec.dataRoot + "/" + spec.namePrefix + "c" + to_string (i));
+			slots.push_back (slot);
+		}
+		for (unsigned i = 0; i < slots.size(); i++) workers.create_thread (boost::bind (&ClusterPool::work, this, i));
+	}
+	/** Stop every cluster */
+	~ClusterPool () {
+		{
+			boost::mutex::scoped_lock lock (mutex);
+			closing = true;
+		}
+		changed.notify_all();
+		workers.join_all();
+		for (unsigned i = 0; i < slots.size(); i++) {
+			if (! slots[i]->cluster) continue;
+			AllocatorScope scope (slots[i]->allocator);
+			try {stopCluster (*slots[i]->cluster);} catch (std::exception&) {}
+		}
+	}
+	/** A warm cluster, waiting for one if none is ready. Raise if every cluster failed to build */
+	Lease checkout () {
+		boost::unique_lock<boost::mutex> lock (mutex);
+		while (true) {
+			unsigned failed = 0;
+			for (unsigned i = 0; i < slots.size(); i++) {
+				if (slots[i]->state == Ready) {
+					slots[i]->state = Leased;
+					return Lease (&* slots[i]->cluster, boost::bind (&ClusterPool::checkin, this, i));
+				}
+				if (slots[i]->state == Failed) failed ++;
+			}
+			if (failed == slots.size()) throw std::runtime_error ("no pooled cluster could be built: " + (slots.empty() ? std::string ("empty pool") : slots[0]->error));
+			changed.wait (lock);
+		}
+	}
+	/** Allocator of leased cluster, to put in scope when growing it (eg. addStartShard) */
+	Allocator& allocatorOf (const Lease& lease) {
+		boost::mutex::scoped_lock lock (mutex);
+		for (unsigned i = 0; i < slots.size(); i++) if (slots[i]->cluster && &* slots[i]->cluster == lease.get()) return slots[i]->allocator;
+		throw std::runtime_error ("cluster not from this pool");
+	}
+	/** Clusters ready for checkout right now */
+	unsigned readyCount () {
+		boost::mutex::scoped_lock lock (mutex);
+		unsigned n = 0;
+		for (unsigned i = 0; i < slots.size(); i++) if (slots[i]->state == Ready) n ++;
+		return n;
+	}
+private:
+	enum State {Building, Ready, Leased, Resetting, Failed};
+	struct Slot {
+		boost::shared_ptr<PortRange> ports;
+		Allocator allocator;
+		boost::optional<Cluster> cluster;
+		State state;
+		std::string error;
+		Slot () : state(Building) {}
+	};
+	boost::function0<Cluster> build;
+	unsigned rebuildMillis;
+	std::vector< boost::shared_ptr<Slot> > slots;
+	bool closing;
+	boost::mutex mutex;
+	boost::condition_variable changed;
+	boost::thread_group workers;
+	/** Lease deleter */
+	void checkin (unsigned i) {
+		{
+			boost::mutex::scoped_lock lock (mutex);
+			slots[i]->state = Resetting;
+		}
+		changed.notify_all();
+	}
+	/** Build i'th cluster, then reset it each time it comes back and build it again rebuildMillis after it fails, until closing */
+	void work (unsigned i) {
+		Slot& slot = *slots[i];
+		AllocatorScope scope (slot.allocator);
+		prepare (slot, false);
+		while (true) {
+			bool reuse;
+			{
+				boost::unique_lock<boost::mutex> lock (mutex);
+				while (slot.state != Resetting && slot.state != Failed && ! closing) changed.wait (lock);
+				if (slot.state == Failed) {
+					boost::system_time retry = boost::get_system_time() + boost::posix_time::milliseconds (rebuildMillis);
+					while (! closing && changed.timed_wait (lock, retry)) ;
+					slot.state = Building;
+				}
+				if (closing) return;
+				reuse = slot.state == Resetting;
+			}
+			prepare (slot, reuse);
+		}
+	}
+	/** Reset slot's cluster if reuse, else (or if reset fails) build it afresh. Then mark it Ready or Failed */
+	void prepare (Slot& slot, bool reuse) {
+		std::string error;
+		try {
+			if (reuse) resetCluster (*slot.cluster);
+		} catch (std::exception&) {
+			try {stopCluster (*slot.cluster);} catch (std::exception&) {}
+			reuse = false;
+		}
+		if (! reuse) {
+			slot.cluster.reset();
+			try {slot.cluster = build();}
+			catch (std::exception& e) {error = e.what();}
+		}
+		{
+			boost::mutex::scoped_lock lock (mutex);
+			slot.state = error.empty() ? Ready : Failed;
+			slot.error = error;
+		}
+		changed.notify_all();
+	}
+};
+
+}
@@ -0,0 +1,36 @@
+/* */
+
+#include "process.h"
+
+using namespace std;
+
+/** Launch processes on "localhost" by fork/exec instead of 10remote (false by default) */
+bool mongoDeploy::launchLocally = false;
+
+mongoDeploy::Process mongoDeploy::launch (remote::Host host, string prefix, string executable, program::Options options) {
+	if (launchLocally && remote::hostPort(host).hostname == "localhost") return lprocess::launch (prefix, executable, options);
+	if (! prefix.empty()) return remote::launch (program::Program (prefix, executable, options), host);
+	program::Program program;
+	program.executable = executable;
+	program.options = options;
+	return remote::launch (program, host);
+}
+
+string mongoDeploy::programExecutable (Process p) {
+	if (! p.isLocal()) return remote::program(*p.rproc).executable;
+	boost::mutex::scoped_lock lock (p.lproc.state->mutex);
+	return p.lproc.state->executable;
+}
+
+program::Options mongoDeploy::programOptions (Process p) {
+	return p.isLocal() ? lprocess::options (p.lproc) : remote::program(*p.rproc).options;
+}
+
+void mongoDeploy::signalProcess (int sig, Process p) {
+	if (p.isLocal()) lprocess::signal (sig, p.lproc); else rprocess::signal (sig, *p.rproc);
+}
+
+/** Launch process again once it has exited with same executable and options (not prefix, so data is kept) */
+void mongoDeploy::restartProcess (Process p) {
+	if (p.isLocal()) lprocess::restart (p.lproc); else rprocess::restart (*p.rproc);
+}
@@ -0,0 +1,46 @@
+/* Handle on a launched mongo process, spawned through 10remote or locally with fork/exec */
+
+#pragma once
+
+#include <string>
+#include <10remote/remote.h>
+#include <10remote/process.h>
+#include <boost/optional.hpp>
+#include "localProcess.h"
+
+namespace mongoDeploy {
+
+/** Launch processes on "localhost" by fork/exec (see localProcess.h) instead of 10remote, so single-box clusters need no remote::listen or RPC (false by default) */
+extern bool launchLocally;
+
+/** A launched mongod or mongos: a 10remote process, or one spawned on this machine with fork/exec. Copies refer to the same process */
+class Process {
+public:
+	remote::Host host;
+	boost::optional<remote::Process> rproc;  // unless local
+	lprocess::Process lproc;  // if local
+	Process (remote::Process p) : host(p.host), rproc(p) {}
+	Process (lprocess::Process p) : host("localhost"), lproc(p) {}
+	Process () {}  // for serialization
+	bool isLocal () const {return lproc.state.get() != 0;}
+	/** False for a default-constructed handle, eg. a slot not yet filled in */
+	bool launched () const {return isLocal() || rproc;}
+};
+
+/** Run `prefix && executable --opt value ...` on host: by fork/exec if launchLocally and host is localhost, else through 10remote. Empty prefix is skipped */
+Process launch (remote::Host, std::string prefix, std::string executable, program::Options);
+
+/** Executable and options process was launched with */
+std::string programExecutable (Process);
+program::Options programOptions (Process);
+
+void signalProcess (int sig, Process);
+
+/** Launch process again once it has exited with same executable and options (not prefix, so data is kept) */
+void restartProcess (Process);
+
+}
+
+inline std::ostream& operator<< (std::ostream& out, const mongoDeploy::Process& x) {
+	if (x.isLocal()) out << x.lproc; else out << *x.rproc;
+	return out;}
@@ -0,0 +1,125 @@
+/* */
+
+#include "rolling.h"
+#include "parallel.h"
+#include "supervisor.h"
+
+using namespace std;
+
+/** Member states by host:port according to current primary. Empty if there is no primary */
+static map<string,int> memberStates (mongoDeploy::ReplicaSet& rs) {
+	map<string,int> states;
+	try {
+		mongo::BSONObj info;
+		rs.primary() ->runCommand ("admin", BSON ("replSetGetStatus" << 1), info);
+		vector<mongo::BSONElement> ms = info.getField("members").Array();
+		for (unsigned i = 0; i < ms.size(); i++) states[ms[i].Obj().getStringField ("name")] = ms[i].Obj().getIntField ("state");
+	} catch (exception& e) {}
+	return states;
+}
+
+/** Wait until member is in one of the given states, per primary */
+static void waitState (mongoDeploy::ReplicaSet& rs, string hostPort, int state1, int state2) {
+	mongoDeploy::Retry r (mongoDeploy::Backoff (600000, 50, 1000));
+	while (true) {
+		map<string,int> states = memberStates (rs);
+		if (states.count (hostPort) && (states[hostPort] == state1 || states[hostPort] == state2)) return;
+		if (! r.sleep()) throw runtime_error (hostPort + " did not come back in " + rs.name());
+	}
+}
+
+/** Terminate i'th replica and start it again on same port and dbpath (not wiped) with merged options */
+static void restartReplica (mongoDeploy::ReplicaSet& rs, unsigned i, program::Options newOpts) {
+	mongoDeploy::MongoD old = rs.replicas[i];
+	string executable = mongoDeploy::programExecutable (old);  // keeps any placement wrapper
+	program::Options options = program::merge (mongoDeploy::programOptions (old), newOpts);
+	vector<mongoDeploy::Supervisor*> watchers = mongoDeploy::unsupervise (old);
+	mongoDeploy::terminate (old);
+	rs.replicas[i] = mongoDeploy::launch (old.host, "", executable, options);
+	mongoDeploy::waitConnect (rs.replicas[i]);
+	for (unsigned j = 0; j < watchers.size(); j++) watchers[j]->watch (rs.replicas[i]);
+}
+
+/** Writes to primary every probeMillis until stopped, summing time writes were failing */
+class WriteProbe {
+	mongoDeploy::ReplicaSet rs;
+	unsigned probeMillis;
+	volatile bool stopped;
+	boost::thread thread;
+public:
+	unsigned unavailableMillis;
+	WriteProbe (mongoDeploy::ReplicaSet rs, unsigned probeMillis) : rs(rs), probeMillis(probeMillis), stopped(false), unavailableMillis(0) {
+		thread = boost::thread (boost::bind (&WriteProbe::run, this));}
+	void stop () {stopped = true; thread.join();}
+private:
+	void run () {
+		boost::optional<boost::posix_time::ptime> downSince;
+		while (! stopped) {
+			boost::posix_time::ptime t = mongoDeploy::now();
+			bool ok;
+			try {
+				mongoDeploy::Connection c = rs.primary();
+				c->update ("admin.rollingProbe", QUERY ("_id" << "probe"), BSON ("$inc" << BSON ("n" << 1)), true);
+				ok = c->getLastError().empty();
+			} catch (exception& e) {
+				ok = false;
+			}
+			if (! ok && ! downSince) downSince = t;
+			if (ok && downSince) {unavailableMillis += (mongoDeploy::now() - *downSince) .total_milliseconds(); downSince.reset();}
+			boost::this_thread::sleep (t + boost::posix_time::milliseconds (probeMillis));
+		}
+		if (downSince) unavailableMillis += (mongoDeploy::now() - *downSince) .total_milliseconds();
+	}
+};
+
+/** Restart every member of replica set with merged options: secondaries one at a time, then primary after stepping it down */
+mongoDeploy::RollingResult mongoDeploy::rollingRestart (ReplicaSet& rs, program::Options newOpts, unsigned probeMillis) {
+	RollingResult result (rs.name());
+	boost::posix_time::ptime start = mongoDeploy::now();
+	map<string,int> states = memberStates (rs);
+	int primary = -1;
+	for (unsigned i = 0; i < rs.replicas.size(); i++) if (states[hostPortString (rs.replicas[i])] == 1) primary = i;
+	if (primary < 0) throw runtime_error ("no primary in " + rs.name());
+	WriteProbe probe (rs, probeMillis);
+	try {
+		for (unsigned i = 0; i < rs.replicas.size(); i++) {
+			if ((int) i == primary) continue;
+			restartReplica (rs, i, newOpts);
+			waitState (rs, hostPortString (rs.replicas[i]), 2, 7);
+			result.restarts ++;
+		}
+		string oldPrimary = hostPortString (rs.replicas[primary]);
+		try {
+			mongo::BSONObj info;
+			connectionPool() .get (oldPrimary) ->runCommand ("admin", BSON ("replSetStepDown" << 60), info);
+		} catch (exception& e) {}  // primary drops connections when stepping down
+		Retry r (Backoff (120000, 50, 1000));
+		while (true) {
+			map<string,int> states = memberStates (rs);
+			if (! states.empty() && states[oldPrimary] != 1) break;
+			if (! r.sleep()) throw runtime_error ("no new primary elected in " + rs.name());
+		}
+		restartReplica (rs, primary, newOpts);
+		waitState (rs, hostPortString (rs.replicas[primary]), 1, 2);
+		result.restarts ++;
+	} catch (...) {
+		probe.stop();
+		throw;
+	}
+	probe.stop();
+	result.writeUnavailableMillis = probe.unavailableMillis;
+	result.millis = (mongoDeploy::now() - start) .total_milliseconds();
+	return result;
+}
+
+/** rollingRestart shard in place, so relaunched replicas are written back even if a later step of it fails */
+static mongoDeploy::RollingResult rollShard (mongoDeploy::ReplicaSet* rs, program::Options newOpts, unsigned probeMillis) {
+	return mongoDeploy::rollingRestart (*rs, newOpts, probeMillis);
+}
+
+/** rollingRestart of every shard of shard set, shards in parallel */
+vector<mongoDeploy::RollingResult> mongoDeploy::rollingRestart (ShardSet& s, program::Options newOpts, unsigned probeMillis) {
+	vector< boost::function0<RollingResult> > rolls;
+	for (unsigned i = 0; i < s.shards.size(); i++) rolls.push_back (boost::bind (rollShard, &s.shards[i], newOpts, probeMillis));
+	return parallel (rolls);
+}
@@ -0,0 +1,30 @@
+/* Restart replica sets member by member, optionally with changed options, keeping a primary up */
+
+#pragma once
+
+#include "mongoDeploy.h"
+
+namespace mongoDeploy {
+
+/** Outcome of rolling restart of one replica set */
+struct RollingResult {
+	std::string replSet;
+	unsigned restarts;
+	unsigned millis;  // total time taken
+	unsigned writeUnavailableMillis;  // time probe writes to primary were failing
+	RollingResult (std::string replSet) : replSet(replSet), restarts(0), millis(0), writeUnavailableMillis(0) {}
+};
+
+/** Restart every member of replica set with its options merged with newOpts (new ones take precedence), keeping dbpath and port.
+ * Secondaries and arbiters go one at a time, each waited on until it is SECONDARY/ARBITER again. Then primary is stepped down and restarted last.
+ * A probe writes to admin.rollingProbe on the current primary every probeMillis to measure write unavailability. rs.replicas is updated with the new processes */
+RollingResult rollingRestart (ReplicaSet& rs, program::Options newOpts = program::Options(), unsigned probeMillis = 50);
+
+/** rollingRestart of every shard of shard set, shards in parallel. Config servers and routers are left alone. Shards are updated in place as their replicas are relaunched, so if one shard fails s still holds the current processes of all of them */
+std::vector<RollingResult> rollingRestart (ShardSet& s, program::Options newOpts = program::Options(), unsigned probeMillis = 50);
+
+}
+
+inline std::ostream& operator<< (std::ostream& out, const mongoDeploy::RollingResult& x) {
+	out << "RollingResult " << x.replSet << " " << x.restarts << " restarts in " << x.millis << "ms, writes unavailable " << x.writeUnavailableMillis << "ms";
+	return out;}
@@ -0,0 +1,98 @@
+/* */
+
+#include "routers.h"
+#include <algorithm>
+
+using namespace std;
+
+/** Routers by preference, routers marked down last */
+struct Ranking {
+	string hostPort;
+	bool down;
+	double primary, secondary;
+	bool operator< (const Ranking& r) const {
+		if (down != r.down) return ! down;
+		if (primary != r.primary) return primary < r.primary;
+		return secondary < r.secondary;
+	}
+};
+
+vector<string> mongoDeploy::RouterSelector::ranked (vector<MongoS> routers) {
+	boost::mutex::scoped_lock lock (mutex);
+	boost::posix_time::ptime t = mongoDeploy::now();
+	vector<Ranking> rs;
+	for (unsigned i = 0; i < routers.size(); i++) {
+		Ranking r;
+		r.hostPort = hostPortString (routers[i]);
+		RouterStats& s = routerStats[r.hostPort];
+		r.down = ! s.downUntil.is_special() && s.downUntil > t;
+		r.primary = policy == LeastOutstanding ? s.outstanding : s.latencyMicros;
+		r.secondary = policy == LeastOutstanding ? s.latencyMicros : s.outstanding;
+		rs.push_back (r);
+	}
+	stable_sort (rs.begin(), rs.end());
+	vector<string> hostPorts;
+	for (unsigned i = 0; i < rs.size(); i++) hostPorts.push_back (rs[i].hostPort);
+	return hostPorts;
+}
+
+/** Ping router if its latency is stale and fold round trip into moving average */
+void mongoDeploy::RouterSelector::measure (string hostPort, Connection c) {
+	{
+		boost::mutex::scoped_lock lock (mutex);
+		RouterStats& s = routerStats[hostPort];
+		if (! s.measured.is_special() && (mongoDeploy::now() - s.measured) .total_milliseconds() < remeasureMillis) return;
+		s.measured = mongoDeploy::now();
+	}
+	boost::posix_time::ptime start = mongoDeploy::now();
+	mongo::BSONObj info;
+	if (! c->runCommand ("admin", BSON ("ping" << 1), info)) throw runtime_error ("ping failed: " + info.toString());
+	double micros = (mongoDeploy::now() - start) .total_microseconds();
+	boost::mutex::scoped_lock lock (mutex);
+	RouterStats& s = routerStats[hostPort];
+	s.latencyMicros = s.latencyMicros == 0 ? micros : 0.8 * s.latencyMicros + 0.2 * micros;
+}
+
+/** Deleter of connections handed out: drop outstanding count, then let pooled connection go back to pool */
+void mongoDeploy::RouterSelector::release (string hostPort, Connection c, mongo::DBClientConnection*) {
+	boost::mutex::scoped_lock lock (mutex);
+	routerStats[hostPort].outstanding --;
+}
+
+/** Pooled connection to best of given routers, failing over to next best if it can't be reached */
+mongoDeploy::Connection mongoDeploy::RouterSelector::connect (vector<MongoS> routers) {
+	vector<string> hostPorts = ranked (routers);
+	string errors;
+	for (unsigned i = 0; i < hostPorts.size(); i++)
+		try {
+			Connection c = connectionPool() .get (hostPorts[i]);
+			measure (hostPorts[i], c);
+			{
+				boost::mutex::scoped_lock lock (mutex);
+				routerStats[hostPorts[i]].outstanding ++;
+			}
+			return Connection (c.get(), boost::bind (&RouterSelector::release, this, hostPorts[i], c, _1));
+		} catch (exception& e) {
+			markDown (hostPorts[i]);
+			errors += " " + hostPorts[i] + ": " + e.what();
+		}
+	throw runtime_error ("no router reachable:" + errors);
+}
+
+/** Skip router for downMillis */
+void mongoDeploy::RouterSelector::markDown (string hostPort) {
+	connectionPool() .clear (hostPort);
+	boost::mutex::scoped_lock lock (mutex);
+	routerStats[hostPort].downUntil = mongoDeploy::now() + boost::posix_time::milliseconds (downMillis);
+}
+
+mongoDeploy::RouterStats mongoDeploy::RouterSelector::stats (string hostPort) {
+	boost::mutex::scoped_lock lock (mutex);
+	return routerStats[hostPort];
+}
+
+/** Selector used by ShardSet::router. Never destroyed so connections released during static destruction are safe */
+mongoDeploy::RouterSelector& mongoDeploy::routerSelector () {
+	static RouterSelector* selector = new RouterSelector();
+	return *selector;
+}
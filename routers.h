@@ -0,0 +1,47 @@
+/* Choose among a shard set's routers (mongos) by load, failing over when one dies */
+
+#pragma once
+
+#include "mongoDeploy.h"
+
+namespace mongoDeploy {
+
+enum RouterPolicy {
+	LeastOutstanding,  // router with fewest connections currently handed out, ties broken by latency (default)
+	LeastLatency  // router with lowest measured ping latency
+};
+
+/** What selector knows about a router */
+struct RouterStats {
+	unsigned outstanding;  // connections handed out and not yet released
+	double latencyMicros;  // moving average of ping round trip
+	boost::posix_time::ptime measured;  // when latency was last measured
+	boost::posix_time::ptime downUntil;  // excluded from selection until then
+	RouterStats () : outstanding(0), latencyMicros(0) {}
+};
+
+/** Tracks load and health of routers by host:port, shared across copies of a ShardSet. Thread-safe */
+class RouterSelector {
+public:
+	RouterPolicy policy;
+	unsigned downMillis;  // how long an unreachable router is skipped (5 secs by default)
+	unsigned remeasureMillis;  // how often latency of a router is re-pinged (1 sec by default)
+	RouterSelector (RouterPolicy policy = LeastOutstanding, unsigned downMillis = 5000, unsigned remeasureMillis = 1000) :
+		policy(policy), downMillis(downMillis), remeasureMillis(remeasureMillis) {}
+	/** Pooled connection to best of given routers, failing over to next best if it can't be reached. Counts as outstanding on that router until last copy is released. Raise if none is reachable */
+	Connection connect (std::vector<MongoS> routers);
+	/** Skip router for downMillis */
+	void markDown (std::string hostPort);
+	RouterStats stats (std::string hostPort);
+private:
+	std::map<std::string, RouterStats> routerStats;
+	boost::mutex mutex;
+	std::vector<std::string> ranked (std::vector<MongoS> routers);
+	void measure (std::string hostPort, Connection c);
+	void release (std::string hostPort, Connection c, mongo::DBClientConnection*);
+};
+
+/** Selector used by ShardSet::router */
+RouterSelector& routerSelector ();
+
+}
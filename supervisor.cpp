@@ -0,0 +1,188 @@
+/* */
+
+#include "supervisor.h"
+#include "parallel.h"
+#include "allocator.h"
+#include <set>
+
+using namespace std;
+
+/** Live supervisors, for unsupervise */
+static boost::mutex registryMutex;
+static set<mongoDeploy::Supervisor*> registry;
+
+mongoDeploy::Supervisor::Supervisor (unsigned heartbeatMillis, unsigned missesToFail) : heartbeatMillis(heartbeatMillis), missesToFail(missesToFail) {
+	boost::mutex::scoped_lock lock (registryMutex);
+	registry.insert (this);
+}
+
+mongoDeploy::Supervisor::~Supervisor () {
+	{
+		boost::mutex::scoped_lock lock (registryMutex);
+		registry.erase (this);
+	}
+	stop();
+}
+
+/** Ping on a pooled connection, so a busy process that is slow to answer still counts as alive */
+static bool remoteAlive (string hostPort) {
+	try {
+		mongoDeploy::Connection c = mongoDeploy::connectionPool() .get (hostPort);
+		mongo::BSONObj info;
+		return c->runCommand ("admin", BSON ("ping" << 1), info);
+	} catch (exception&) {
+		mongoDeploy::connectionPool() .clear (hostPort);
+		return false;
+	}
+}
+
+static bool remoteDown (string host, unsigned port) {return ! mongoDeploy::portInUse (host, port);}
+
+static bool localDown (lprocess::Process p) {return ! lprocess::alive (p);}
+
+void mongoDeploy::Supervisor::watch (Process p) {
+	boost::mutex::scoped_lock lock (mutex);
+	if (p.isLocal())
+		targets.push_back (Target (hostPortString (p), boost::bind (lprocess::alive, p.lproc), boost::bind (localDown, p.lproc), boost::bind (restartProcess, p), 1));
+	else {
+		mongo::HostAndPort hp = hostAndPort (p);
+		targets.push_back (Target (hp.toString(), boost::bind (remoteAlive, hp.toString()), boost::bind (remoteDown, hp.host(), hp.port()), boost::bind (restartProcess, p), missesToFail));
+	}
+	targets.back().lastSeen = mongoDeploy::now();
+}
+
+bool mongoDeploy::Supervisor::unwatch (const Process& p) {
+	string hostPort = hostPortString (p);
+	boost::mutex::scoped_lock lock (mutex);
+	bool found = false;
+	for (unsigned i = 0; i < targets.size(); i++)
+		if (targets[i].watched && targets[i].hostPort == hostPort) {targets[i].watched = false; found = true;}
+	return found;
+}
+
+vector<mongoDeploy::Supervisor*> mongoDeploy::unsupervise (const Process& p) {
+	boost::mutex::scoped_lock lock (registryMutex);
+	vector<Supervisor*> watchers;
+	for (set<Supervisor*>::iterator it = registry.begin(); it != registry.end(); ++it)
+		if ((*it)->unwatch (p)) watchers.push_back (*it);
+	return watchers;
+}
+
+/** Supervise every process of shard set */
+void mongoDeploy::Supervisor::watch (ShardSet s) {
+	vector<Process> procs = processes (s);
+	for (unsigned i = 0; i < procs.size(); i++) watch (procs[i]);
+}
+
+/** Heartbeat i'th target. After too many misses, start its recovery if it is confirmed down */
+Unit mongoDeploy::Supervisor::beat (unsigned i) {
+	boost::function0<bool> alive, down;
+	{
+		boost::mutex::scoped_lock lock (mutex);
+		if (targets[i].restarting || ! targets[i].watched) return unit;
+		alive = targets[i].alive;
+		down = targets[i].down;
+	}
+	bool ok = alive();
+	boost::posix_time::ptime t = mongoDeploy::now();
+	{
+		boost::mutex::scoped_lock lock (mutex);
+		Target& target = targets[i];
+		if (ok) {target.misses = 0; target.lastSeen = t; return unit;}
+		if (++ target.misses < target.missesToFail) return unit;
+	}
+	bool dead = down();
+	boost::mutex::scoped_lock lock (mutex);
+	Target& target = targets[i];
+	if (! target.watched) return unit;  // unwatched meanwhile, eg. being stopped on purpose
+	if (! dead) {target.misses = 0; return unit;}  // still listening: busy, don't relaunch over it
+	target.restarting = true;
+	log.push_back (Recovery (target.hostPort, t, (t - target.lastSeen) .total_milliseconds()));
+	if (target.recovery) target.recovery->join();  // previous recovery has finished, since restarting was false
+	target.recovery.reset (new boost::thread (boost::bind (&Supervisor::recover, this, i, log.size() - 1)));
+	return unit;
+}
+
+/** Restart i'th target and wait until it is alive again */
+void mongoDeploy::Supervisor::recover (unsigned i, unsigned logIndex) {
+	Target target ("", 0, 0, 0, 0);
+	{
+		boost::mutex::scoped_lock lock (mutex);
+		target = targets[i];
+	}
+	bool recovered = false;
+	string error;
+	try {
+		if (! target.watched) throw runtime_error ("unwatched before restart");
+		target.restart();
+		connectionPool() .clear (target.hostPort);
+		waitConnect (target.hostPort, Backoff (300000, 10, 500));
+		recovered = true;
+	} catch (exception& e) {
+		error = e.what();
+	}
+	boost::mutex::scoped_lock lock (mutex);
+	Recovery& rec = log[logIndex];
+	rec.recovered = recovered;
+	rec.error = error;
+	rec.recoverMillis = (mongoDeploy::now() - rec.detected) .total_milliseconds();
+	targets[i].restarting = false;
+	targets[i].misses = 0;
+	targets[i].lastSeen = mongoDeploy::now();
+}
+
+void mongoDeploy::Supervisor::run () {
+	while (true) {
+		boost::posix_time::ptime next = mongoDeploy::now() + boost::posix_time::milliseconds (heartbeatMillis);
+		unsigned n;
+		{
+			boost::mutex::scoped_lock lock (mutex);
+			n = targets.size();
+		}
+		vector< boost::function0<Unit> > beats;
+		for (unsigned i = 0; i < n; i++) beats.push_back (boost::bind (&Supervisor::beat, this, i));
+		{
+			boost::this_thread::disable_interruption heartbeating;  // parallel must join its threads before beats go out of scope
+			parallel (beats);
+		}
+		boost::this_thread::sleep (next);  // interruption point
+	}
+}
+
+void mongoDeploy::Supervisor::start () {
+	if (! heartbeat) heartbeat.reset (new boost::thread (boost::bind (&Supervisor::run, this)));
+}
+
+/** Stop heartbeats and wait for restarts in progress */
+void mongoDeploy::Supervisor::stop () {
+	if (! heartbeat) return;
+	heartbeat->interrupt();
+	heartbeat->join();
+	heartbeat.reset();
+	vector< boost::shared_ptr<boost::thread> > recoveries;
+	{
+		boost::mutex::scoped_lock lock (mutex);
+		for (unsigned i = 0; i < targets.size(); i++) if (targets[i].recovery) recoveries.push_back (targets[i].recovery);
+	}
+	for (unsigned i = 0; i < recoveries.size(); i++) recoveries[i]->join();
+}
+
+vector<mongoDeploy::Recovery> mongoDeploy::Supervisor::recoveries () {
+	boost::mutex::scoped_lock lock (mutex);
+	return log;
+}
+
+double mongoDeploy::Supervisor::meanDetectMillis () {
+	boost::mutex::scoped_lock lock (mutex);
+	double total = 0;
+	for (unsigned i = 0; i < log.size(); i++) total += log[i].detectMillis;
+	return log.empty() ? 0 : total / log.size();
+}
+
+double mongoDeploy::Supervisor::meanRecoverMillis () {
+	boost::mutex::scoped_lock lock (mutex);
+	double total = 0;
+	unsigned n = 0;
+	for (unsigned i = 0; i < log.size(); i++) if (log[i].recovered) {total += log[i].recoverMillis; n ++;}
+	return n == 0 ? 0 : total / n;
+}
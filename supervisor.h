@@ -0,0 +1,73 @@
+/* Detect dead mongo processes by heartbeat and restart them */
+
+#pragma once
+
+#include "mongoDeploy.h"
+#include <boost/noncopyable.hpp>
+#include <10util/util.h>
+
+namespace mongoDeploy {
+
+/** A detected failure and its recovery */
+struct Recovery {
+	std::string hostPort;
+	boost::posix_time::ptime detected;
+	unsigned detectMillis;  // from last good heartbeat (or exit, for local processes) to detection
+	unsigned recoverMillis;  // from detection to accepting connections again after restart
+	bool recovered;
+	std::string error;  // why restart failed, if not recovered
+	Recovery (std::string hostPort, boost::posix_time::ptime detected, unsigned detectMillis) : hostPort(hostPort), detected(detected), detectMillis(detectMillis), recoverMillis(0), recovered(false) {}
+};
+
+/** Heartbeats every supervised process every heartbeatMillis: a ping on a pooled connection for remote processes, a non-blocking waitpid for local ones. After missesToFail failed heartbeats in a row (1 for local processes, whose exit is certain) the process is restarted with the same options and dbpath, unless its port is still open (busy, not dead), and the recovery is recorded once it accepts connections again */
+class Supervisor : boost::noncopyable {
+public:
+	Supervisor (unsigned heartbeatMillis = 1000, unsigned missesToFail = 5);
+	/** Stops supervising */
+	~Supervisor ();
+	/** Supervise every process of shard set */
+	void watch (ShardSet);
+	void watch (Process);
+	/** Stop supervising process, eg. before stopping it on purpose. True if it was watched */
+	bool unwatch (const Process&);
+	void start ();
+	void stop ();
+	/** Failures detected so far, oldest first */
+	std::vector<Recovery> recoveries ();
+	/** Mean detection latency and mean time to recovery of recovered failures, in millis */
+	double meanDetectMillis ();
+	double meanRecoverMillis ();
+private:
+	struct Target {
+		std::string hostPort;
+		boost::function0<bool> alive;
+		boost::function0<bool> down;  // confirms failure before restart
+		boost::function0<void> restart;
+		unsigned missesToFail;
+		unsigned misses;
+		boost::posix_time::ptime lastSeen;
+		bool restarting;
+		bool watched;  // false once unwatched. Kept in targets so indexes of running beats and recoveries stay valid
+		boost::shared_ptr<boost::thread> recovery;  // last one, joined before starting the next
+		Target (std::string hostPort, boost::function0<bool> alive, boost::function0<bool> down, boost::function0<void> restart, unsigned missesToFail) :
+			hostPort(hostPort), alive(alive), down(down), restart(restart), missesToFail(missesToFail), misses(0), restarting(false), watched(true) {}
+	};
+	std::vector<Target> targets;
+	std::vector<Recovery> log;
+	unsigned heartbeatMillis;
+	unsigned missesToFail;
+	boost::mutex mutex;
+	boost::shared_ptr<boost::thread> heartbeat;
+	void run ();
+	Unit beat (unsigned i);
+	void recover (unsigned i, unsigned logIndex);
+};
+
+/** Unwatch process in every live Supervisor and return those that were watching it, eg. to watch its replacement. terminate() calls it, so deliberate stops (removeStopShard, removeStopReplica, rollingRestart, stopCluster) are not taken for failures */
+std::vector<Supervisor*> unsupervise (const Process&);
+
+}
+
+inline std::ostream& operator<< (std::ostream& out, const mongoDeploy::Recovery& x) {
+	out << "Recovery " << x.hostPort << " detected in " << x.detectMillis << "ms, " << (x.recovered ? "recovered in " + to_string (x.recoverMillis) + "ms" : "not recovered: " + x.error);
+	return out;}
@@ -0,0 +1,29 @@
+/* Assumes util, remote, and mongoDeploy libraries have been built and installed in /usr/local/include and /usr/local/lib.
+ * Compile as: g++ addReplica.cpp -o addReplica -I/usr/local/include -L/usr/local/lib -lboost_system-mt -lboost_filesystem-mt -lboost_thread-mt -lboost_serialization-mt -l10util -lremote -lmongoDeploy -lmongoclient -lpcre
+ * Run as: `addReplica [numDocs]`. Loads a two-member replica set, then compares time to add a member by initial sync vs snapshot seeding */
+
+#include <mongoDeploy/mongoDeploy.h>
+
+using namespace std;
+
+static mongoDeploy::RsMemberSpec memberSpec () {
+	return mongoDeploy::RsMemberSpec (program::options ("noprealloc", "", "oplogSize", "50"), mongo::BSONObj());
+}
+
+int main (int argc, const char* argv[]) {
+	boost::shared_ptr<boost::thread> th = remote::listen();
+	int n = argc > 1 ? atoi (argv[1]) : 100000;
+	vector<remote::Host> hosts (2, "localhost");
+	vector<mongoDeploy::RsMemberSpec> specs (2, memberSpec());
+	mongoDeploy::ReplicaSet rs = mongoDeploy::startReplicaSet (hosts, specs);
+	string pad (1000, 'x');
+	mongoDeploy::Connection c = rs.primary();
+	for (int i = 0; i < n; i++) c->insert ("test.add", BSON ("_id" << i << "pad" << pad));
+	c->getLastError();
+	unsigned synced = rs.addStartReplica ("localhost", memberSpec(), false);
+	unsigned seeded = rs.addStartReplica ("localhost", memberSpec(), true);
+	cout << rs.nameActiveHosts() << endl;
+	cout << "initial sync: " << synced << "ms, snapshot seed: " << seeded << "ms" << endl;
+	mongoDeploy::stopProcesses (rs.replicas);
+	exit (0);
+}
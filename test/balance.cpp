@@ -0,0 +1,36 @@
+/* Assumes util, remote, and mongoDeploy libraries have been built and installed in /usr/local/include and /usr/local/lib.
+ * Compile as: g++ balance.cpp -o balance -I/usr/local/include -L/usr/local/lib -lboost_system-mt -lboost_filesystem-mt -lboost_thread-mt -lboost_serialization-mt -l10util -lremote -lmongoDeploy -lmongoclient -lpcre
+ * Run as: `balance [concurrency]`. Loads a collection onto one shard with the balancer stopped, then evens it out with rebalance */
+
+#include <mongoDeploy/mongoDeploy.h>
+#include <mongoDeploy/balance.h>
+
+using namespace std;
+
+static mongoDeploy::ShardSet startShardSet () {
+	vector<remote::Host> hosts;
+	hosts.push_back ("localhost");
+	mongoDeploy::ShardSet s = mongoDeploy::startShardSet (hosts, hosts, program::Options(), program::options ("chunkSize", "1"));
+	vector<mongoDeploy::RsMemberSpec> specs;
+	specs.push_back (mongoDeploy::RsMemberSpec (program::options ("noprealloc", "", "oplogSize", "50"), mongo::BSONObj()));
+	vector<mongoDeploy::ReplicaSetSpec> shards;
+	for (unsigned i = 0; i < 3; i++) shards.push_back (mongoDeploy::ReplicaSetSpec (hosts, specs));
+	s.addStartShards (shards);
+	return s;
+}
+
+int main (int argc, const char* argv[]) {
+	boost::shared_ptr<boost::thread> th = remote::listen();
+	unsigned concurrency = argc > 1 ? atoi (argv[1]) : 2;
+	mongoDeploy::ShardSet s = startShardSet();
+	mongoDeploy::setBalancerStopped (s.router(), true);
+	mongoDeploy::shardDatabase (s.routers[0], "test");
+	mongoDeploy::shardCollection (s.routers[0], "test.bal", BSON ("_id" << 1));
+	string pad (1000, 'x');
+	mongoDeploy::Connection c = s.router();
+	for (int i = 0; i < 20000; i++) c->insert ("test.bal", BSON ("_id" << i << "pad" << pad));
+	c->getLastError();
+	cout << mongoDeploy::distribution (s, "test.bal") << endl;
+	cout << mongoDeploy::rebalance (s, "test.bal", mongoDeploy::RebalanceOptions (concurrency)) << endl;
+	cout << mongoDeploy::distribution (s, "test.bal") << endl;
+}
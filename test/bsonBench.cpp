@@ -0,0 +1,78 @@
+/* Assumes util, remote, and mongoDeploy libraries have been built and installed in /usr/local/include and /usr/local/lib.
+ * Compile as: g++ bsonBench.cpp -o bsonBench -I/usr/local/include -L/usr/local/lib -lboost_system-mt -lboost_filesystem-mt -lboost_thread-mt -lboost_serialization-mt -l10util -lremote -lmongoDeploy -lmongoclient -lpcre
+ * Run as: `bsonBench [iterations]`. Round-trips a 100-shard ShardSet through io::encode/io::decode and reports bytes/sec and allocations per round trip, with and without a BsonArena */
+
+#include <mongoDeploy/mongoDeploy.h>
+#include <10util/io.h>
+#include <boost/archive/binary_oarchive.hpp>
+#include <boost/scoped_ptr.hpp>
+#include <sstream>
+#include <new>
+
+using namespace std;
+
+/** Count every heap allocation made through operator new */
+static unsigned long newCount;
+
+void* operator new (size_t n) throw (std::bad_alloc) {
+	__sync_fetch_and_add (&newCount, 1);
+	void* p = malloc (n);
+	if (! p) throw std::bad_alloc();
+	return p;
+}
+
+void operator delete (void* p) throw () {free (p);}
+
+/** ShardSet of numShards 3-member shards. Processes are not launched, only their specs are serialized */
+static mongoDeploy::ShardSet bigShardSet (unsigned numShards) {
+	mongoDeploy::ShardSet s (mongoDeploy::ConfigSet (vector<mongoDeploy::MongoD> (3)), vector<mongoDeploy::MongoS> (3));
+	for (unsigned i = 0; i < numShards; i++) {
+		vector<mongoDeploy::RsMemberSpec> specs;
+		specs.push_back (mongoDeploy::RsMemberSpec (program::options ("dur", "", "oplogSize", "200"), BSON ("priority" << 2 << "tags" << BSON ("dc" << "east" << "shard" << i))));
+		specs.push_back (mongoDeploy::RsMemberSpec (program::options ("dur", "", "oplogSize", "200"), BSON ("priority" << 1 << "tags" << BSON ("dc" << "west" << "shard" << i))));
+		specs.push_back (mongoDeploy::RsMemberSpec (program::options ("oplogSize", "4"), BSON ("arbiterOnly" << true)));
+		s.shards.push_back (mongoDeploy::ReplicaSet (vector<mongoDeploy::MongoD> (3), specs));
+	}
+	return s;
+}
+
+/** Size of serialized ShardSet. io::encode uses boost serialization so an equivalent binary archive gives its payload size */
+static unsigned long payloadBytes (const mongoDeploy::ShardSet& s) {
+	ostringstream out;
+	boost::archive::binary_oarchive ar (out);
+	ar << s;
+	return out.str().size();
+}
+
+static double secsSince (boost::posix_time::ptime start) {
+	return (boost::posix_time::microsec_clock::universal_time() - start) .total_microseconds() / 1e6;
+}
+
+static void bench (const mongoDeploy::ShardSet& s, unsigned iterations, bool useArena) {
+	unsigned long bytes = payloadBytes (s);
+	unsigned long news = newCount;
+	mongoDeploy::BsonLoadStats before = mongoDeploy::bsonLoadStats();
+	boost::posix_time::ptime start = boost::posix_time::microsec_clock::universal_time();
+	for (unsigned i = 0; i < iterations; i++) {
+		io::Code c = io::encode (s);
+		mongoDeploy::BsonArena arena;
+		boost::scoped_ptr<mongoDeploy::BsonArenaScope> scope (useArena ? new mongoDeploy::BsonArenaScope (arena) : 0);
+		mongoDeploy::ShardSet t = io::decode<mongoDeploy::ShardSet> (c);
+		assert (t.shards.size() == s.shards.size());
+	}
+	double secs = secsSince (start);
+	mongoDeploy::BsonLoadStats after = mongoDeploy::bsonLoadStats();
+	cout << (useArena ? "arena: " : "owned: ")
+		<< bytes << " bytes/roundtrip, "
+		<< (unsigned long) (bytes * iterations / secs) << " bytes/sec, "
+		<< (newCount - news) / iterations << " operator-new allocs/roundtrip, "
+		<< (after.allocations - before.allocations) / iterations << " bson buffer allocs/roundtrip ("
+		<< (after.objects - before.objects) / iterations << " objects)" << endl;
+}
+
+int main (int argc, const char* argv[]) {
+	unsigned iterations = argc > 1 ? atoi (argv[1]) : 200;
+	mongoDeploy::ShardSet s = bigShardSet (100);
+	bench (s, iterations, false);
+	bench (s, iterations, true);
+}
@@ -0,0 +1,31 @@
+/* Assumes util, remote, and mongoDeploy libraries have been built and installed in /usr/local/include and /usr/local/lib.
+ * Compile as: g++ dbPathTemplate.cpp -o dbPathTemplate -I/usr/local/include -L/usr/local/lib -lboost_system-mt -lboost_filesystem-mt -lboost_thread-mt -lboost_serialization-mt -l10util -lremote -lmongoDeploy -lmongoclient -lpcre
+ * Run as: `dbPathTemplate [numMongoDs]`. Compares mongod startup time with empty vs template-cloned dbpaths */
+
+#include <mongoDeploy/mongoDeploy.h>
+#include <10util/thread.h>
+
+using namespace std;
+
+/** Start n journaled mongods on localhost in given dbpath mode, stop them, and return their mean time to accept connections */
+static unsigned meanStartMillis (mongoDeploy::DbPathInit mode, unsigned n) {
+	mongoDeploy::dbPathInit = mode;
+	vector<remote::Host> hosts (n, "localhost");
+	mongoDeploy::clearReadyTimes();
+	mongoDeploy::ConfigSet cs = mongoDeploy::startConfigSet (hosts, program::options ("dur", ""));
+	vector<mongoDeploy::ReadyTime> times = mongoDeploy::readyTimes();
+	mongoDeploy::stopProcesses (cs.cfgServers);
+	unsigned total = 0;
+	for (unsigned i = 0; i < times.size(); i++) {total += times[i].millis; cout << " " << times[i] << endl;}
+	return times.empty() ? 0 : total / times.size();
+}
+
+int main (int argc, const char* argv[]) {
+	unsigned n = argc > 1 ? atoi (argv[1]) : 3;
+	boost::shared_ptr<boost::thread> th = remote::listen();
+	unsigned plain = meanStartMillis (mongoDeploy::EmptyDbPath, n);
+	meanStartMillis (mongoDeploy::ReflinkTemplate, 1);  // make template
+	unsigned cloned = meanStartMillis (mongoDeploy::ReflinkTemplate, n);
+	cout << "empty dbpath: " << plain << "ms, template clone: " << cloned << "ms, saving: " << (int) plain - (int) cloned << "ms per mongod" << endl;
+	exit (0);
+}
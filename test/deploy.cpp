@@ -0,0 +1,30 @@
+/* Assumes util, remote, and mongoDeploy libraries have been built and installed in /usr/local/include and /usr/local/lib.
+ * Compile as: g++ deploy.cpp -o deploy -I/usr/local/include -L/usr/local/lib -lboost_system-mt -lboost_filesystem-mt -lboost_thread-mt -lboost_serialization-mt -l10util -lremote -lmongoDeploy -lmongoclient -lpcre
+ * Run as: `deploy`. Deploys a two-shard cluster on localhost from a JSON spec, prints step timings, and checks the result against the spec */
+
+#include <mongoDeploy/mongoDeploy.h>
+#include <mongoDeploy/deploy.h>
+
+using namespace std;
+
+static const char* spec =
+	"{config: {hosts: ['localhost']},"
+	" routers: {hosts: ['localhost', 'localhost'], opts: {chunkSize: 2}},"
+	" shards: [{members: [{host: 'localhost', opts: {noprealloc: true, oplogSize: 50}}, {host: 'localhost', opts: {noprealloc: true, oplogSize: 50}}, {host: 'localhost', config: {arbiterOnly: true}}]},"
+	"          {members: [{host: 'localhost', opts: {noprealloc: true, oplogSize: 50}}]}],"
+	" databases: ['test'],"
+	" collections: [{ns: 'test.deploy', key: {_id: 1}}]}";
+
+int main (int argc, const char* argv[]) {
+	boost::shared_ptr<boost::thread> th = remote::listen();
+	vector<mongoDeploy::StepTiming> timings;
+	mongoDeploy::ShardSet s = mongoDeploy::deploy (string (spec), &timings);
+	for (unsigned i = 0; i < timings.size(); i++) cout << timings[i] << endl;
+	bool ok = s.configSet.cfgServers.size() == 1 && s.routers.size() == 2 && s.shards.size() == 2
+		&& s.shards[0].replicas.size() == 3 && s.shards[1].replicas.size() == 1;
+	mongo::BSONObj coll = s.router()->findOne ("config.collections", BSON ("_id" << "test.deploy"));
+	ok = ok && !coll.isEmpty();
+	cout << s << endl << (ok ? "matches spec" : "FAILED: does not match spec") << endl;
+	mongoDeploy::stopProcesses (mongoDeploy::processes (s));
+	exit (0);
+}
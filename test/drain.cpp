@@ -0,0 +1,43 @@
+/* Assumes util, remote, and mongoDeploy libraries have been built and installed in /usr/local/include and /usr/local/lib.
+ * Compile as: g++ drain.cpp -o drain -I/usr/local/include -L/usr/local/lib -lboost_system-mt -lboost_filesystem-mt -lboost_thread-mt -lboost_serialization-mt -l10util -lremote -lmongoDeploy -lmongoclient -lpcre
+ * Run as: `drain [maxMbPerSec]`. Spreads a collection over two shards, then drains and removes the second, printing progress and ETA */
+
+#include <mongoDeploy/mongoDeploy.h>
+
+using namespace std;
+
+static mongoDeploy::ShardSet startShardSet () {
+	vector<remote::Host> hosts;
+	hosts.push_back ("localhost");
+	mongoDeploy::ShardSet s = mongoDeploy::startShardSet (hosts, hosts, program::Options(), program::options ("chunkSize", "1"));
+	vector<mongoDeploy::RsMemberSpec> specs;
+	specs.push_back (mongoDeploy::RsMemberSpec (program::options ("noprealloc", "", "oplogSize", "50"), mongo::BSONObj()));
+	vector<mongoDeploy::ReplicaSetSpec> shards;
+	for (unsigned i = 0; i < 2; i++) shards.push_back (mongoDeploy::ReplicaSetSpec (hosts, specs));
+	s.addStartShards (shards);
+	return s;
+}
+
+static void printProgress (mongoDeploy::DrainProgress p) {
+	cout << " " << p << endl;
+}
+
+int main (int argc, const char* argv[]) {
+	boost::shared_ptr<boost::thread> th = remote::listen();
+	double maxMbPerSec = argc > 1 ? atof (argv[1]) : 0;
+	mongoDeploy::ShardSet s = startShardSet();
+	mongoDeploy::shardDatabase (s.routers[0], "test");
+	mongoDeploy::shardCollection (s.routers[0], "test.drain", BSON ("_id" << 1));
+	string pad (1000, 'x');
+	mongoDeploy::Connection c = s.router();
+	for (int i = 0; i < 20000; i++) c->insert ("test.drain", BSON ("_id" << i << "pad" << pad));
+	c->getLastError();
+	mongoDeploy::DrainOptions opts (1000, maxMbPerSec);
+	opts.onProgress = printProgress;
+	mongoDeploy::DrainProgress done = s.removeStopShard (1, opts);
+	cout << done << " in " << done.elapsedMillis << "ms" << endl;
+	long long count = s.router()->count ("test.drain");
+	cout << s.shards.size() << " shard left, " << count << " docs" << (count == 20000 ? "" : " MISSING DOCS") << endl;
+	mongoDeploy::stopProcesses (mongoDeploy::processes (s));
+	exit (0);
+}
@@ -0,0 +1,41 @@
+/* Assumes util, remote, and mongoDeploy libraries have been built and installed in /usr/local/include and /usr/local/lib.
+ * Compile as: g++ loader.cpp -o loader -I/usr/local/include -L/usr/local/lib -lboost_system-mt -lboost_filesystem-mt -lboost_thread-mt -lboost_serialization-mt -l10util -lremote -lmongoDeploy -lmongoclient -lpcre
+ * Run as: `loader [docs]`. Writes a file of concatenated BSON, then bulk loads it into a presplit collection of a two-shard, two-router shard set */
+
+#include <mongoDeploy/mongoDeploy.h>
+#include <mongoDeploy/loader.h>
+#include <fstream>
+
+using namespace std;
+
+static mongoDeploy::ShardSet startShardSet () {
+	vector<remote::Host> hosts;
+	hosts.push_back ("localhost");
+	vector<remote::Host> routerHosts (2, "localhost");
+	mongoDeploy::ShardSet s = mongoDeploy::startShardSet (hosts, routerHosts);
+	vector<mongoDeploy::RsMemberSpec> specs;
+	specs.push_back (mongoDeploy::RsMemberSpec (program::options ("noprealloc", "", "oplogSize", "50"), mongo::BSONObj()));
+	vector<mongoDeploy::ReplicaSetSpec> shards;
+	for (unsigned i = 0; i < 2; i++) shards.push_back (mongoDeploy::ReplicaSetSpec (hosts, specs));
+	s.addStartShards (shards);
+	return s;
+}
+
+int main (int argc, const char* argv[]) {
+	boost::shared_ptr<boost::thread> th = remote::listen();
+	unsigned docs = argc > 1 ? atoi (argv[1]) : 200000;
+	{
+		ofstream out ("loader.bson", ios::binary);
+		string pad (200, 'x');
+		for (unsigned i = 0; i < docs; i++) {
+			mongo::BSONObj doc = BSON ("_id" << (int) i << "pad" << pad);
+			out.write (doc.objdata(), doc.objsize());
+		}
+	}
+	mongoDeploy::ShardSet s = startShardSet();
+	mongoDeploy::shardDatabase (s.routers[0], "test");
+	mongoDeploy::shardCollectionPresplit (s, "test.load", BSON ("_id" << 1), mongoDeploy::splitPoints (BSON ("_id" << 1), 0, docs, 8));
+	mongoDeploy::LoadResult r = mongoDeploy::bulkLoad (s, "test.load", string ("loader.bson"));
+	cout << r << endl;
+	assert (s.router() ->count ("test.load") == docs);
+}
@@ -0,0 +1,40 @@
+/* Assumes util, remote, and mongoDeploy libraries have been built and installed in /usr/local/include and /usr/local/lib.
+ * Compile as: g++ local.cpp -o local -I/usr/local/include -L/usr/local/lib -lboost_system-mt -lboost_filesystem-mt -lboost_thread-mt -lboost_serialization-mt -l10util -lremote -lmongoDeploy -lmongoclient -lpcre
+ * Run as: `local`. Starts, kills and restarts a mongod, then a localhost replica set, through the local fork/exec path, no remote::listen needed */
+
+#include <mongoDeploy/mongoDeploy.h>
+
+using namespace std;
+
+int main (int argc, const char* argv[]) {
+	mongoDeploy::LocalMongoD p = mongoDeploy::startLocalMongoD (program::options ("noprealloc", ""));
+	string hostPort = mongoDeploy::hostPortString (p);
+	mongoDeploy::waitConnect (hostPort);
+	cout << "Started " << p << endl;
+	lprocess::signal (SIGKILL, p);
+	lprocess::wait (p);
+	assert (! lprocess::alive (p));
+	cout << "Killed " << p << endl;
+	lprocess::restart (p);
+	mongoDeploy::connectionPool() .clear (hostPort);
+	mongoDeploy::waitConnect (hostPort);
+	cout << "Restarted " << p << endl;
+	for (unsigned i = 0; i < mongoDeploy::readyTimes().size(); i++) cout << mongoDeploy::readyTimes()[i] << endl;
+	lprocess::signal (SIGTERM, p);
+	lprocess::wait (p);
+
+	mongoDeploy::launchLocally = true;
+	vector<mongoDeploy::RsMemberSpec> specs;
+	specs.push_back (mongoDeploy::RsMemberSpec (program::Options(), mongo::BSONObj()));
+	specs.push_back (mongoDeploy::RsMemberSpec (program::Options(), mongo::BSONObj()));
+	specs.push_back (mongoDeploy::RsMemberSpec (program::Options(), BSON ("arbiterOnly" << true)));
+	mongoDeploy::ReplicaSet rs = mongoDeploy::startReplicaSet (vector<remote::Host> (3, "localhost"), specs);
+	cout << rs.nameActiveHosts() << endl;
+	mongoDeploy::Process secondary = rs.replicas[1];
+	mongoDeploy::signalProcess (SIGKILL, secondary);
+	mongoDeploy::restartProcess (secondary);
+	mongoDeploy::connectionPool() .clear (mongoDeploy::hostPortString (secondary));
+	mongoDeploy::waitConnect (secondary);
+	cout << "Restarted " << secondary << endl;
+	mongoDeploy::stopProcesses (rs.replicas);
+}
@@ -0,0 +1,36 @@
+/* Assumes util, remote, and mongoDeploy libraries have been built and installed in /usr/local/include and /usr/local/lib.
+ * Compile as: g++ pool.cpp -o pool -I/usr/local/include -L/usr/local/lib -lboost_system-mt -lboost_filesystem-mt -lboost_thread-mt -lboost_serialization-mt -l10util -lremote -lmongoDeploy -lmongoclient -lpcre
+ * Run as: `pool [clusters] [suites]`. Runs suites against a pool of warm replica sets, clusters at a time */
+
+#include <mongoDeploy/mongoDeploy.h>
+#include <mongoDeploy/pool.h>
+
+using namespace std;
+
+static mongoDeploy::ReplicaSet buildReplicaSet () {
+	vector<remote::Host> hosts (2, "localhost");
+	vector<mongoDeploy::RsMemberSpec> specs;
+	specs.push_back (mongoDeploy::RsMemberSpec (program::options ("noprealloc", "", "oplogSize", "50"), mongo::BSONObj()));
+	specs.push_back (mongoDeploy::RsMemberSpec (program::Options(), BSON ("arbiterOnly" << true)));
+	return mongoDeploy::startReplicaSet (hosts, specs);
+}
+
+/** Stand-in for a test suite: check cluster is empty, then dirty it */
+static void suite (mongoDeploy::ClusterPool<mongoDeploy::ReplicaSet>* pool, unsigned i) {
+	mongoDeploy::ClusterPool<mongoDeploy::ReplicaSet>::Lease rs = pool->checkout();
+	mongoDeploy::Connection c = rs->primary();
+	assert (c->count ("test.suite") == 0);
+	for (int j = 0; j < 1000; j++) c->insert ("test.suite", BSON ("_id" << j << "suite" << i));
+	c->getLastError();
+	cout << "suite " << i << " ran on " << rs->name() << endl;
+}
+
+int main (int argc, const char* argv[]) {
+	boost::shared_ptr<boost::thread> th = remote::listen();
+	unsigned clusters = argc > 1 ? atoi (argv[1]) : 3;
+	unsigned suites = argc > 2 ? atoi (argv[2]) : 9;
+	mongoDeploy::ClusterPool<mongoDeploy::ReplicaSet> pool (buildReplicaSet, mongoDeploy::ClusterPoolSpec (clusters));
+	boost::thread_group runs;
+	for (unsigned i = 0; i < suites; i++) runs.create_thread (boost::bind (suite, &pool, i));
+	runs.join_all();
+}
@@ -0,0 +1,29 @@
+/* Assumes util, remote, and mongoDeploy libraries have been built and installed in /usr/local/include and /usr/local/lib.
+ * Compile as: g++ rolling.cpp -o rolling -I/usr/local/include -L/usr/local/lib -lboost_system-mt -lboost_filesystem-mt -lboost_thread-mt -lboost_serialization-mt -l10util -lremote -lmongoDeploy -lmongoclient -lpcre
+ * Run as: `rolling [probeMillis]`. Rolling-restarts a replica set with journaling turned on and reports how long writes were unavailable */
+
+#include <mongoDeploy/mongoDeploy.h>
+#include <mongoDeploy/rolling.h>
+
+using namespace std;
+
+static mongoDeploy::ReplicaSet startReplicaSet () {
+	vector<remote::Host> hosts (3, "localhost");
+	vector<mongoDeploy::RsMemberSpec> specs;
+	specs.push_back (mongoDeploy::RsMemberSpec (program::options ("noprealloc", "", "oplogSize", "50"), mongo::BSONObj()));
+	specs.push_back (mongoDeploy::RsMemberSpec (program::options ("noprealloc", "", "oplogSize", "50"), mongo::BSONObj()));
+	specs.push_back (mongoDeploy::RsMemberSpec (program::options ("noprealloc", "", "oplogSize", "4"), BSON ("arbiterOnly" << true)));
+	return mongoDeploy::startReplicaSet (hosts, specs);
+}
+
+int main (int argc, const char* argv[]) {
+	boost::shared_ptr<boost::thread> th = remote::listen();
+	unsigned probeMillis = argc > 1 ? atoi (argv[1]) : 50;
+	mongoDeploy::ReplicaSet rs = startReplicaSet();
+	mongoDeploy::RollingResult r = mongoDeploy::rollingRestart (rs, program::options ("dur", ""), probeMillis);
+	cout << r << endl;
+	cout << rs.nameActiveHosts() << endl;
+	cout << (r.restarts == rs.replicas.size() ? "all members restarted" : "FAILED: not all members restarted") << endl;
+	mongoDeploy::stopProcesses (rs.replicas);
+	exit (0);
+}
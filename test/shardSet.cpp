@@ -3,6 +3,8 @@
  * Run as: `shardSet` */
 
 #include <mongoDeploy/mongoDeploy.h>
+#include <mongoDeploy/trace.h>
+#include <mongoDeploy/placement.h>
 #include <10util/thread.h>
 
 using namespace std;
@@ -34,6 +36,8 @@ static vector<mongoDeploy::RsMemberSpec> rsSpecWithArbiter (unsigned numActiveSe
 }
 
 static mongoDeploy::ShardSet startShardSet() {
+	// Give config server, mongos and the four shard servers a sixth of this machine's CPUs each, arbiters the last CPU
+	mongoDeploy::placement() .plan (vector<remote::Host> (6, "localhost"), vector<remote::Host> (2, "localhost"));
 	// Launch empty shard set with one config server and one mongos with small chunk size
 	vector<remote::Host> hosts;
 	hosts.push_back ("localhost");
@@ -41,16 +45,18 @@ static mongoDeploy::ShardSet startShardSet() {
 	// Launch two shards, each a replica set of 2 severs and one arbiter
 	hosts.push_back ("localhost");
 	hosts.push_back ("localhost");
-	s.addStartShard (hosts, rsSpecWithArbiter(2));
-	s.addStartShard (hosts, rsSpecWithArbiter(2));
+	vector<mongoDeploy::ReplicaSetSpec> shards;
+	shards.push_back (mongoDeploy::ReplicaSetSpec (hosts, rsSpecWithArbiter(2)));
+	shards.push_back (mongoDeploy::ReplicaSetSpec (hosts, rsSpecWithArbiter(2)));
+	s.addStartShards (shards);
 	return s;
 }
 
 /** All replica-set shard processes excluding arbiters */
-static vector<rprocess::Process> activeShardProcesses (mongoDeploy::ShardSet s) {
-	vector<rprocess::Process> procs;
+static vector<mongoDeploy::Process> activeShardProcesses (mongoDeploy::ShardSet s) {
+	vector<mongoDeploy::Process> procs;
 	for (unsigned i = 0; i < s.shards.size(); i ++) {
-		vector<rprocess::Process> rsProcs = s.shards[i].activeReplicas();
+		vector<mongoDeploy::Process> rsProcs = s.shards[i].activeReplicas();
 		for (unsigned j = 0; j < rsProcs.size(); j ++) procs.push_back (rsProcs[j]);
 	}
 	return procs;
@@ -58,15 +64,15 @@ static vector<rprocess::Process> activeShardProcesses (mongoDeploy::ShardSet s)
 
 /** Kill random server every once in a while and restart it */
 static Unit killer (mongoDeploy::ShardSet s) {
-	vector<rprocess::Process> procs = activeShardProcesses (s);
+	vector<mongoDeploy::Process> procs = activeShardProcesses (s);
 	thread::sleep (rand() % 10);
 	while (true) {
 		unsigned r = rand() % procs.size();
-		rprocess::Process p = procs[r];
-		rprocess::signal (SIGKILL, p);
+		mongoDeploy::Process p = procs[r];
+		mongoDeploy::signalProcess (SIGKILL, p);
 		cout << "Killed " << p << endl;
 		thread::sleep (rand() % 30);
-		rprocess::restart (p);
+		mongoDeploy::restartProcess (p);
 		cout << "Restarted  " << p << endl;
 		thread::sleep (rand() % 60);
 	}
@@ -81,6 +87,7 @@ void testShardSet () {
 
 int main (int argc, const char* argv[]) {
 	boost::shared_ptr<boost::thread> th = remote::listen();
+	mongoDeploy::echoSpans = true;
 	testShardSet();
 	th->join();
 }
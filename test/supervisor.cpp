@@ -0,0 +1,27 @@
+/* Assumes util, remote, and mongoDeploy libraries have been built and installed in /usr/local/include and /usr/local/lib.
+ * Compile as: g++ supervisor.cpp -o supervisor -I/usr/local/include -L/usr/local/lib -lboost_system-mt -lboost_filesystem-mt -lboost_thread-mt -lboost_serialization-mt -l10util -lremote -lmongoDeploy -lmongoclient -lpcre
+ * Run as: `supervisor`. Kills a supervised local mongod a few times and reports detection latency and time to recovery */
+
+#include <mongoDeploy/mongoDeploy.h>
+#include <mongoDeploy/supervisor.h>
+
+using namespace std;
+
+int main (int argc, const char* argv[]) {
+	mongoDeploy::LocalMongoD p = mongoDeploy::startLocalMongoD (program::options ("noprealloc", ""));
+	string hostPort = mongoDeploy::hostPortString (p);
+	mongoDeploy::waitConnect (hostPort);
+	mongoDeploy::Supervisor supervisor (100);
+	supervisor.watch (p);
+	supervisor.start();
+	for (unsigned i = 0; i < 3; i++) {
+		lprocess::signal (SIGKILL, p);
+		cout << "Killed " << p << endl;
+		while (supervisor.recoveries().size() <= i || ! supervisor.recoveries()[i].recovered) boost::this_thread::sleep (boost::posix_time::milliseconds (50));
+		cout << supervisor.recoveries()[i] << endl;
+	}
+	supervisor.stop();
+	cout << "Mean detection " << supervisor.meanDetectMillis() << "ms, mean recovery " << supervisor.meanRecoverMillis() << "ms" << endl;
+	lprocess::signal (SIGTERM, p);
+	lprocess::wait (p);
+}
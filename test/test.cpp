@@ -17,6 +17,21 @@ void testBsonObj () {
 	cout << y << endl;
 }
 
+void testBsonArena () {
+	mongo::BSONObj x = BSON ("a" << "hello" << "bb" << 42);
+	io::Code c = io::encode (x);
+	mongoDeploy::BsonArena arena;
+	{
+		mongoDeploy::BsonArenaScope scope (arena);
+		mongo::BSONObj y = io::decode<mongo::BSONObj> (c);
+		assert (x == y);
+		assert (! y.isOwned());
+	}
+	mongo::BSONObj z = io::decode<mongo::BSONObj> (c);
+	assert (z.isOwned());
+}
+
 int main (int argc, const char* argv[]) {
 	testBsonObj();
+	testBsonArena();
 }
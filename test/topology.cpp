@@ -0,0 +1,36 @@
+/* Assumes util, remote, and mongoDeploy libraries have been built and installed in /usr/local/include and /usr/local/lib.
+ * Compile as: g++ topology.cpp -o topology -I/usr/local/include -L/usr/local/lib -lboost_system-mt -lboost_filesystem-mt -lboost_thread-mt -lboost_serialization-mt -l10util -lremote -lmongoDeploy -lmongoclient -lpcre
+ * Run as: `topology [path]`. Saves a one-shard cluster's topology, reattaches to it, then checks that reattach refuses once a process is gone */
+
+#include <mongoDeploy/mongoDeploy.h>
+#include <mongoDeploy/topology.h>
+
+using namespace std;
+
+static mongoDeploy::ShardSet startShardSet () {
+	vector<remote::Host> hosts;
+	hosts.push_back ("localhost");
+	mongoDeploy::ShardSet s = mongoDeploy::startShardSet (hosts, hosts);
+	vector<mongoDeploy::RsMemberSpec> specs;
+	specs.push_back (mongoDeploy::RsMemberSpec (program::options ("noprealloc", "", "oplogSize", "50"), mongo::BSONObj()));
+	s.addStartShard (hosts, specs);
+	return s;
+}
+
+int main (int argc, const char* argv[]) {
+	boost::shared_ptr<boost::thread> th = remote::listen();
+	string path = argc > 1 ? argv[1] : "/tmp/mongoDeploy-topology.bin";
+	mongoDeploy::ShardSet s = startShardSet();
+	mongoDeploy::saveTopology (path, s);
+	mongoDeploy::ShardSet t = mongoDeploy::reattach (path);
+	cout << "reattached " << t << endl;
+	mongoDeploy::stopProcesses (t.routers);
+	try {
+		mongoDeploy::reattach (path, mongoDeploy::Backoff (500, 5, 100));
+		cout << "FAILED: reattached with router stopped" << endl;
+	} catch (exception& e) {
+		cout << "refused as expected: " << e.what() << endl;
+	}
+	mongoDeploy::stopProcesses (mongoDeploy::processes (t));
+	exit (0);
+}
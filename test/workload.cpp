@@ -0,0 +1,77 @@
+/* Assumes util, remote, and mongoDeploy libraries have been built and installed in /usr/local/include and /usr/local/lib.
+ * Compile as: g++ workload.cpp -o workload -I/usr/local/include -L/usr/local/lib -lboost_system-mt -lboost_filesystem-mt -lboost_thread-mt -lboost_serialization-mt -l10util -lremote -lmongoDeploy -lmongoclient -lpcre
+ * Run as: `workload [numShards [numRouters [threads [seconds [kill]]]]]`. Deploys a shard set on localhost, drives an insert/read/update mix through all routers and prints latency percentiles and throughput. With "kill", random shard replicas are killed and restarted during the run */
+
+#include <mongoDeploy/mongoDeploy.h>
+#include <mongoDeploy/workload.h>
+#include <mongoDeploy/trace.h>
+
+using namespace std;
+
+/** Specification for a replica set of given number of active servers */
+static vector<mongoDeploy::RsMemberSpec> rsSpecWithArbiter (unsigned numActiveServers) {
+	std::vector<mongoDeploy::RsMemberSpec> specs;
+	for (unsigned i = 0; i < numActiveServers; i++)
+		specs.push_back (mongoDeploy::RsMemberSpec (program::options ("dur", "", "noprealloc", "", "oplogSize", "200"), mongo::BSONObj()));
+	specs.push_back (mongoDeploy::RsMemberSpec (program::options ("dur", "", "noprealloc", "", "oplogSize", "4"), BSON ("arbiterOnly" << true)));
+	return specs;
+}
+
+static mongoDeploy::ShardSet startShardSet (unsigned numShards, unsigned numRouters) {
+	vector<remote::Host> cfgHosts (1, "localhost");
+	vector<remote::Host> routerHosts (numRouters, "localhost");
+	mongoDeploy::ShardSet s = mongoDeploy::startShardSet (cfgHosts, routerHosts);
+	vector<mongoDeploy::ReplicaSetSpec> shards;
+	for (unsigned i = 0; i < numShards; i++)
+		shards.push_back (mongoDeploy::ReplicaSetSpec (vector<remote::Host> (3, "localhost"), rsSpecWithArbiter(2)));
+	s.addStartShards (shards);
+	return s;
+}
+
+/** All replica-set shard processes excluding arbiters */
+static vector<mongoDeploy::Process> activeShardProcesses (mongoDeploy::ShardSet s) {
+	vector<mongoDeploy::Process> procs;
+	for (unsigned i = 0; i < s.shards.size(); i ++) {
+		vector<mongoDeploy::Process> rsProcs = s.shards[i].activeReplicas();
+		for (unsigned j = 0; j < rsProcs.size(); j ++) procs.push_back (rsProcs[j]);
+	}
+	return procs;
+}
+
+/** Kill random server every once in a while and restart it, until interrupted */
+static void killer (mongoDeploy::ShardSet s) {
+	vector<mongoDeploy::Process> procs = activeShardProcesses (s);
+	boost::posix_time::ptime start = boost::posix_time::microsec_clock::universal_time();
+	while (true) {
+		boost::this_thread::sleep (boost::posix_time::seconds (5 + rand() % 10));
+		mongoDeploy::Process p = procs [rand() % procs.size()];
+		mongoDeploy::signalProcess (SIGKILL, p);
+		cout << "Killed " << p << " at " << (boost::posix_time::microsec_clock::universal_time() - start) .total_milliseconds() << "ms" << endl;
+		boost::this_thread::sleep (boost::posix_time::seconds (rand() % 10));
+		mongoDeploy::restartProcess (p);
+		cout << "Restarted " << p << " at " << (boost::posix_time::microsec_clock::universal_time() - start) .total_milliseconds() << "ms" << endl;
+	}
+}
+
+int main (int argc, const char* argv[]) {
+	unsigned numShards = argc > 1 ? atoi (argv[1]) : 2;
+	unsigned numRouters = argc > 2 ? atoi (argv[2]) : 2;
+	mongoDeploy::WorkloadSpec spec;
+	if (argc > 3) spec.threads = atoi (argv[3]);
+	if (argc > 4) spec.seconds = atoi (argv[4]);
+	bool kill = argc > 5 && string (argv[5]) == "kill";
+	boost::shared_ptr<boost::thread> th = remote::listen();
+	mongoDeploy::ShardSet s = startShardSet (numShards, numRouters);
+	mongoDeploy::shardDatabase (s.routers[0], "bench");
+	mongoDeploy::shardCollection (s.routers[0], spec.ns, BSON ("_id" << 1));
+	boost::thread k;
+	if (kill) k = boost::thread (killer, s);
+	mongoDeploy::WorkloadResult r = mongoDeploy::runWorkload (s, spec);
+	k.interrupt();
+	k.join();
+	cout << r << endl << "ops/sec per " << r.sampleMillis << "ms:";
+	for (unsigned i = 0; i < r.timeline.size(); i++) cout << " " << (unsigned long) r.timeline[i];
+	cout << endl;
+	mongoDeploy::writeChromeTrace ("workload-trace.json");
+	exit (0);
+}
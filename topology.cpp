@@ -0,0 +1,84 @@
+/* */
+
+#include "topology.h"
+#include "parallel.h"
+#include "allocator.h"
+#include <10util/util.h>
+#include <fstream>
+#include <cstdio>
+#include <cstring>
+#include <boost/archive/binary_oarchive.hpp>
+#include <boost/archive/binary_iarchive.hpp>
+#include <boost/interprocess/file_mapping.hpp>
+#include <boost/interprocess/mapped_region.hpp>
+#include <boost/iostreams/device/array.hpp>
+#include <boost/iostreams/stream.hpp>
+
+using namespace std;
+
+/** File header, last byte is format version */
+static const char Magic[8] = {'m', 'o', 'n', 'g', 'o', 'T', 'o', 2};
+
+/** Write shard set and current counters to file as a compact binary snapshot. File is replaced atomically */
+void mongoDeploy::saveTopology (string path, ShardSet s) {
+	string tmp = path + ".tmp";
+	{
+		ofstream out (tmp.c_str(), ios::binary | ios::trunc);
+		if (! out) throw runtime_error ("can't write topology file " + tmp);
+		out.write (Magic, sizeof Magic);
+		boost::archive::binary_oarchive ar (out, boost::archive::no_header);
+		Topology t (s, counters());
+		ar << t;
+		out.flush();
+		if (! out) throw runtime_error ("failed writing topology file " + tmp);
+	}
+	if (rename (tmp.c_str(), path.c_str()) != 0) throw runtime_error ("can't rename " + tmp + " to " + path);
+}
+
+/** Read snapshot back from memory-mapped file. Raise if file is not a topology snapshot */
+mongoDeploy::Topology mongoDeploy::loadTopology (string path) {
+	using namespace boost::interprocess;
+	file_mapping file (path.c_str(), read_only);
+	mapped_region region (file, read_only);
+	const char* data = (const char*) region.get_address();
+	size_t size = region.get_size();
+	if (size < sizeof Magic || memcmp (data, Magic, sizeof Magic) != 0) throw runtime_error ("not a topology file: " + path);
+	boost::iostreams::stream<boost::iostreams::array_source> in (data + sizeof Magic, size - sizeof Magic);
+	boost::archive::binary_iarchive ar (in, boost::archive::no_header);
+	Topology t;
+	ar >> t;
+	return t;
+}
+
+static bool reachable (mongoDeploy::Process p, mongoDeploy::Backoff backoff) {
+	try {
+		mongoDeploy::waitConnect (p, backoff);
+		return true;
+	} catch (exception& e) {
+		return false;
+	}
+}
+
+/** Processes of shard set that do not accept connections within backoff, all probed in parallel */
+vector<mongoDeploy::Process> mongoDeploy::unreachable (ShardSet s, Backoff backoff) {
+	vector<Process> procs = processes (s);
+	vector< boost::function0<bool> > probes;
+	for (unsigned i = 0; i < procs.size(); i++) probes.push_back (boost::bind (reachable, procs[i], backoff));
+	vector<bool> alive = parallel (probes);
+	vector<Process> dead;
+	for (unsigned i = 0; i < procs.size(); i++) if (! alive[i]) dead.push_back (procs[i]);
+	return dead;
+}
+
+/** Load snapshot, check that every process is alive, advance counters past the snapshot's, and return its shard set. Raise listing unreachable processes if any */
+mongoDeploy::ShardSet mongoDeploy::reattach (string path, Backoff backoff) {
+	Topology t = loadTopology (path);
+	vector<Process> procs = processes (t.shardSet);
+	vector<Process> dead = unreachable (t.shardSet, backoff);
+	if (! dead.empty())
+		throw runtime_error ("can't reattach to " + path + ", unreachable: " + concat (intersperse (string(","), fmap (hostPortString, dead))));
+	advanceCounters (t.counters);
+	for (unsigned i = 0; i < procs.size(); i++)
+		allocator() .reservePort (remote::hostPort(procs[i].host).hostname, hostAndPort (procs[i]) .port());
+	return t.shardSet;
+}
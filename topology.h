@@ -0,0 +1,46 @@
+/* Persist a deployment's topology to a file and reattach to it from another driver process */
+
+#pragma once
+
+#include "mongoDeploy.h"
+
+namespace mongoDeploy {
+
+/** Shard set plus the counters in effect when it was saved */
+struct Topology {
+	ShardSet shardSet;
+	Counters counters;
+	Topology (ShardSet shardSet, Counters counters) : shardSet(shardSet), counters(counters) {}
+	Topology () {}  // for serialization
+};
+
+/** Write shard set and current counters to file as a compact binary snapshot. File is replaced atomically */
+void saveTopology (std::string path, ShardSet);
+
+/** Read snapshot back from memory-mapped file. Raise if file is not a topology snapshot */
+Topology loadTopology (std::string path);
+
+/** Processes of shard set that do not accept connections within backoff, all probed in parallel */
+std::vector<Process> unreachable (ShardSet, Backoff = Backoff (2000, 5, 100));
+
+/** Load snapshot, check that every process is alive, advance counters past the snapshot's, and return its shard set. Raise listing unreachable processes if any */
+ShardSet reattach (std::string path, Backoff = Backoff (2000, 5, 100));
+
+}
+
+/* Serialization */
+
+namespace boost {
+namespace serialization {
+
+template <class Archive> void serialize (Archive & ar, mongoDeploy::Counters & x, const unsigned version) {
+	ar & x.nextDbPath;
+	ar & x.nextReplicaSetId;
+}
+
+template <class Archive> void serialize (Archive & ar, mongoDeploy::Topology & x, const unsigned version) {
+	ar & x.shardSet;
+	ar & x.counters;
+}
+
+}}
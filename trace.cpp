@@ -0,0 +1,172 @@
+/* */
+
+#include "trace.h"
+#include <vector>
+#include <sstream>
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+#include <exception>
+#include <boost/thread.hpp>
+
+using namespace std;
+
+/** Record spans (true by default) */
+bool mongoDeploy::tracing = true;
+/** Also print each finished span to cout (false by default) */
+bool mongoDeploy::echoSpans = false;
+/** Most spans kept in memory (100000 by default) */
+unsigned mongoDeploy::traceCapacity = 100000;
+
+namespace {
+
+struct Event {
+	const char* name;
+	string detail;
+	string outcome;
+	long long startMicros;
+	long long durMicros;
+};
+
+/** Fixed block of events. Writer fills events[count] then publishes it by incrementing count, so readers never see a partial event */
+struct Chunk {
+	static const unsigned Size = 256;
+	Event events[Size];
+	volatile unsigned count;
+	Chunk* volatile next;
+	Chunk () : count(0), next(0) {}
+};
+
+/** Events of one thread at a time. Written only by its owning thread, read by dumps */
+struct Buffer {
+	unsigned tid;
+	Chunk* head;
+	Chunk* tail;
+	Buffer* next;  // in list of all buffers
+	volatile unsigned owned;  // 1 while a live thread writes to it
+	Buffer (unsigned tid) : tid(tid), head(new Chunk), tail(head), next(0), owned(1) {}
+	void append (const Event& e) {
+		if (tail->count == Chunk::Size) {
+			Chunk* c = new Chunk;
+			__sync_synchronize();
+			tail->next = c;
+			tail = c;
+		}
+		tail->events[tail->count] = e;
+		__sync_synchronize();
+		tail->count ++;
+	}
+};
+
+/** Buffers of all threads that ever recorded a span. Buffers outlive their threads so their spans can still be dumped, and are reused by later threads, so there are only as many as threads that recorded at the same time */
+Buffer* volatile buffers;
+unsigned nextTid;
+
+/** Spans recorded and dropped since last clearTrace */
+volatile unsigned long recorded;
+volatile unsigned long dropped;
+
+/** On thread exit, keep buffer for its spans and hand it to the next thread that needs one */
+void releaseBuffer (Buffer* b) {
+	__sync_synchronize();
+	b->owned = 0;
+}
+
+boost::thread_specific_ptr<Buffer> threadBuffer (releaseBuffer);
+
+const boost::posix_time::ptime epoch (boost::gregorian::date (1970, 1, 1));
+
+/** This thread's buffer: on first use, one released by an exited thread, else a new one pushed onto buffers list (lock-free) */
+Buffer* buffer () {
+	Buffer* b = threadBuffer.get();
+	if (b) return b;
+	for (b = buffers; b; b = b->next)
+		if (__sync_bool_compare_and_swap (&b->owned, 0, 1)) {
+			threadBuffer.reset (b);
+			return b;
+		}
+	b = new Buffer (__sync_add_and_fetch (&nextTid, 1));
+	do b->next = buffers; while (! __sync_bool_compare_and_swap (&buffers, b->next, b));
+	threadBuffer.reset (b);
+	return b;
+}
+
+string jsonEscape (string s) {
+	stringstream out;
+	for (unsigned i = 0; i < s.size(); i++) {
+		char c = s[i];
+		if (c == '"' || c == '\\') out << '\\' << c;
+		else if (c == '\n') out << "\\n";
+		else if ((unsigned char) c < 0x20) out << ' ';
+		else out << c;
+	}
+	return out.str();
+}
+
+}
+
+mongoDeploy::Span::Span (const char* name, string detail) : name(name), active(spanning()) {
+	if (! active) return;
+	this->detail = detail;
+	start = boost::posix_time::microsec_clock::universal_time();
+	if (echoSpans) cout << name << " " << detail << " ->" << endl;
+}
+
+void mongoDeploy::Span::outcome (string r) {
+	if (active) result = r;}
+
+mongoDeploy::Span::~Span () {
+	if (! active) return;
+	if (result.empty() && uncaught_exception()) result = "exception";
+	boost::posix_time::ptime end = boost::posix_time::microsec_clock::universal_time();
+	if (echoSpans) cout << " " << name << " " << result << " (" << (end - start) .total_milliseconds() << "ms)" << endl;
+	if (! tracing) return;
+	if (__sync_add_and_fetch (&recorded, 1) > traceCapacity) {__sync_add_and_fetch (&dropped, 1); return;}
+	Event e;
+	e.name = name;
+	e.detail = detail;
+	e.outcome = result;
+	e.startMicros = (start - epoch) .total_microseconds();
+	e.durMicros = (end - start) .total_microseconds();
+	buffer() ->append (e);
+}
+
+/** All spans recorded so far, in Chrome trace event JSON */
+string mongoDeploy::chromeTrace () {
+	stringstream out;
+	out << "{\"traceEvents\":[";
+	bool first = true;
+	for (Buffer* b = buffers; b; b = b->next)
+		for (Chunk* c = b->head; c; c = c->next) {
+			unsigned n = c->count;
+			__sync_synchronize();
+			for (unsigned i = 0; i < n; i++) {
+				Event& e = c->events[i];
+				out << (first ? "" : ",") << "\n{\"name\":\"" << e.name << "\",\"cat\":\"mongoDeploy\",\"ph\":\"X\",\"ts\":" << e.startMicros << ",\"dur\":" << e.durMicros
+					<< ",\"pid\":1,\"tid\":" << b->tid << ",\"args\":{\"detail\":\"" << jsonEscape (e.detail) << "\",\"outcome\":\"" << jsonEscape (e.outcome) << "\"}}";
+				first = false;
+			}
+		}
+	out << "\n]}\n";
+	return out.str();
+}
+
+void mongoDeploy::writeChromeTrace (string path) {
+	ofstream out (path.c_str());
+	out << chromeTrace();
+	if (! out) throw runtime_error ("can't write trace to " + path);
+}
+
+unsigned long mongoDeploy::droppedSpans () {return dropped;}
+
+/** Forget recorded spans. Only call while no spans are open */
+void mongoDeploy::clearTrace () {
+	recorded = dropped = 0;
+	for (Buffer* b = buffers; b; b = b->next) {
+		Chunk* c = b->head->next;
+		while (c) {Chunk* n = c->next; delete c; c = n;}
+		b->head->next = 0;
+		b->head->count = 0;
+		b->tail = b->head;
+	}
+}
@@ -0,0 +1,44 @@
+/* Timed spans around deployment phases, recorded per thread and dumped as a Chrome/Perfetto trace */
+
+#pragma once
+
+#include <string>
+#include <boost/date_time/posix_time/posix_time.hpp>
+#include <boost/noncopyable.hpp>
+
+namespace mongoDeploy {
+
+/** Record spans (true by default). When false (and echoSpans is false) a Span costs one branch, not counting its arguments */
+extern bool tracing;
+/** Also print each finished span to cout, like the progress output of older versions (false by default) */
+extern bool echoSpans;
+
+/** Most spans kept in memory (100000 by default). Spans finishing beyond it are dropped until clearTrace */
+extern unsigned traceCapacity;
+/** Spans dropped since the last clearTrace because traceCapacity was reached */
+unsigned long droppedSpans ();
+
+/** Whether spans are recorded or echoed. Guard costly detail and outcome strings with it (eg. BSON toString) */
+inline bool spanning () {return tracing || echoSpans;}
+
+/** Records its lifetime as a named span with optional detail (eg. command) and outcome (eg. reply). A span still open when unwinding from an exception gets outcome "exception" unless set. Appending is lock-free: each thread writes its own buffer, handed on to a later thread once it exits */
+class Span : boost::noncopyable {
+	const char* name;
+	std::string detail;
+	std::string result;
+	boost::posix_time::ptime start;
+	bool active;
+public:
+	Span (const char* name, std::string detail = "");
+	~Span ();
+	void outcome (std::string);
+};
+
+/** All spans recorded so far, in Chrome trace event JSON (load in chrome://tracing or ui.perfetto.dev) */
+std::string chromeTrace ();
+void writeChromeTrace (std::string path);
+
+/** Forget recorded spans. Only call while no spans are open */
+void clearTrace ();
+
+}
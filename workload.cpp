@@ -0,0 +1,137 @@
+/* */
+
+#include "workload.h"
+#include <algorithm>
+#include <cstdlib>
+
+using namespace std;
+
+/** Buckets 0..15 hold exact values, then 16 buckets per power of 2 */
+static unsigned bucketOf (unsigned long v) {
+	if (v < 16) return v;
+	unsigned m = 0;
+	while ((v >> m) >= 32) m++;
+	return 16 + m * 16 + ((v >> m) - 16);
+}
+
+/** Largest value in bucket */
+static unsigned long bucketMax (unsigned b) {
+	if (b < 16) return b;
+	unsigned m = (b - 16) / 16;
+	return (((b - 16) % 16 + 17) << m) - 1;
+}
+
+mongoDeploy::Histogram::Histogram () : buckets (16 + 64 * 16), total(0), maxValue(0) {}
+
+void mongoDeploy::Histogram::record (unsigned long micros) {
+	buckets [bucketOf (micros)] ++;
+	total ++;
+	if (micros > maxValue) maxValue = micros;
+}
+
+void mongoDeploy::Histogram::merge (const Histogram& h) {
+	for (unsigned i = 0; i < buckets.size(); i++) buckets[i] += h.buckets[i];
+	total += h.total;
+	maxValue = std::max (maxValue, h.maxValue);
+}
+
+/** Upper bound of bucket holding the q'th quantile (0..1), eg. 0.99 for p99 */
+unsigned long mongoDeploy::Histogram::percentile (double q) const {
+	if (total == 0) return 0;
+	unsigned long rank = (unsigned long) (q * total);
+	unsigned long seen = 0;
+	for (unsigned i = 0; i < buckets.size(); i++) {
+		seen += buckets[i];
+		if (seen > rank) return std::min (bucketMax (i), maxValue);
+	}
+	return maxValue;
+}
+
+/** Longest stretch in millis where throughput stayed below fraction of median interval throughput */
+unsigned mongoDeploy::WorkloadResult::longestDipMillis (double fraction) const {
+	if (timeline.empty()) return 0;
+	vector<double> sorted = timeline;
+	sort (sorted.begin(), sorted.end());
+	double threshold = sorted [sorted.size() / 2] * fraction;
+	unsigned longest = 0, run = 0;
+	for (unsigned i = 0; i < timeline.size(); i++) {
+		run = timeline[i] < threshold ? run + 1 : 0;
+		longest = std::max (longest, run);
+	}
+	return longest * sampleMillis;
+}
+
+/** Per-worker state, merged into result when workers finish */
+struct Worker {
+	mongoDeploy::Histogram inserts, reads, updates;
+	unsigned long errors;
+	Worker () : errors(0) {}
+};
+
+static void work (string router, mongoDeploy::WorkloadSpec spec, unsigned id, Worker* w, volatile bool* stop, volatile unsigned long* completed) {
+	unsigned seed = id;
+	long long base = (long long) id << 40;  // disjoint _id range per worker
+	long long inserted = 0;  // insert attempts: a failed one may still have been applied, so its _id is never retried
+	string padding (spec.docBytes, 'x');
+	unsigned weights = spec.insertRatio + spec.readRatio + spec.updateRatio;
+	mongoDeploy::Connection c;
+	while (! *stop) {
+		unsigned r = rand_r (&seed) % weights;
+		bool insert = r < spec.insertRatio || inserted == 0;
+		bool read = ! insert && r < spec.insertRatio + spec.readRatio;
+		long long key = base + (insert ? inserted ++ : rand_r (&seed) % inserted);
+		boost::posix_time::ptime start = mongoDeploy::now();
+		try {
+			if (! c) c = mongoDeploy::connectionPool() .get (router);
+			if (insert) c->insert (spec.ns, BSON ("_id" << key << "n" << 0 << "pad" << padding));
+			else if (read) c->findOne (spec.ns, QUERY ("_id" << key));
+			else c->update (spec.ns, QUERY ("_id" << key), BSON ("$inc" << BSON ("n" << 1)));
+			if (! read) {
+				string err = c->getLastError();
+				if (! err.empty()) throw runtime_error (err);
+			}
+		} catch (exception& e) {
+			w->errors ++;
+			c.reset();  // reconnect on next op
+			boost::this_thread::sleep (boost::posix_time::milliseconds (10));
+			continue;
+		}
+		unsigned long micros = (mongoDeploy::now() - start) .total_microseconds();
+		if (insert) w->inserts.record (micros);
+		else if (read) w->reads.record (micros);
+		else w->updates.record (micros);
+		__sync_fetch_and_add (completed, 1);
+	}
+}
+
+/** Run workload against shard set for spec.seconds. Worker i uses router i mod number of routers */
+mongoDeploy::WorkloadResult mongoDeploy::runWorkload (ShardSet s, WorkloadSpec spec) {
+	if (s.routers.empty()) throw runtime_error ("no routers to run workload through");
+	volatile bool stop = false;
+	volatile unsigned long completed = 0;
+	vector<Worker> workers (spec.threads);
+	boost::thread_group threads;
+	boost::posix_time::ptime start = mongoDeploy::now();
+	for (unsigned i = 0; i < spec.threads; i++)
+		threads.create_thread (boost::bind (work, hostPortString (s.routers [i % s.routers.size()]), spec, i, &workers[i], &stop, &completed));
+	WorkloadResult result;
+	result.sampleMillis = spec.sampleMillis;
+	unsigned long last = 0;
+	for (unsigned t = 0; t < spec.seconds * 1000; t += spec.sampleMillis) {
+		boost::this_thread::sleep (boost::posix_time::milliseconds (spec.sampleMillis));
+		unsigned long done = completed;
+		result.timeline.push_back ((done - last) * 1000.0 / spec.sampleMillis);
+		last = done;
+	}
+	stop = true;
+	threads.join_all();
+	result.seconds = (mongoDeploy::now() - start) .total_milliseconds() / 1000.0;
+	result.errors = 0;
+	for (unsigned i = 0; i < workers.size(); i++) {
+		result.inserts.merge (workers[i].inserts);
+		result.reads.merge (workers[i].reads);
+		result.updates.merge (workers[i].updates);
+		result.errors += workers[i].errors;
+	}
+	return result;
+}
@@ -0,0 +1,64 @@
+/* Drive an insert/read/update workload through a shard set's routers and measure it */
+
+#pragma once
+
+#include "mongoDeploy.h"
+
+namespace mongoDeploy {
+
+/** Latency histogram in microseconds with log-linear buckets (16 per power of 2, ~6% resolution). Not thread-safe: keep one per thread and merge */
+class Histogram {
+	std::vector<unsigned long> buckets;
+	unsigned long total;
+	unsigned long maxValue;
+public:
+	Histogram ();
+	void record (unsigned long micros);
+	void merge (const Histogram&);
+	unsigned long count () const {return total;}
+	unsigned long max () const {return maxValue;}
+	/** Upper bound of bucket holding the q'th quantile (0..1), eg. 0.99 for p99 */
+	unsigned long percentile (double q) const;
+};
+
+/** Operation mix and shape of a workload. Ratios are relative weights */
+struct WorkloadSpec {
+	std::string ns;  // full collection name
+	unsigned threads;
+	unsigned insertRatio, readRatio, updateRatio;
+	unsigned docBytes;  // size of padding field in inserted docs
+	unsigned seconds;  // run time
+	unsigned sampleMillis;  // throughput timeline resolution
+	WorkloadSpec (std::string ns = "bench.docs", unsigned threads = 8, unsigned insertRatio = 1, unsigned readRatio = 8, unsigned updateRatio = 1, unsigned docBytes = 256, unsigned seconds = 30, unsigned sampleMillis = 500) :
+		ns(ns), threads(threads), insertRatio(insertRatio), readRatio(readRatio), updateRatio(updateRatio), docBytes(docBytes), seconds(seconds), sampleMillis(sampleMillis) {}
+};
+
+/** Latencies and throughput of a workload run */
+struct WorkloadResult {
+	Histogram inserts, reads, updates;
+	unsigned long errors;
+	double seconds;
+	/** Ops/sec completed in each sampleMillis interval, in order */
+	std::vector<double> timeline;
+	unsigned sampleMillis;
+	unsigned long ops () const {return inserts.count() + reads.count() + updates.count();}
+	double opsPerSec () const {return seconds > 0 ? ops() / seconds : 0;}
+	/** Longest stretch in millis where throughput stayed below fraction (eg. 0.5) of median interval throughput. Measures failover dips */
+	unsigned longestDipMillis (double fraction = 0.5) const;
+};
+
+/** Run workload against shard set for spec.seconds. Worker i uses router i mod number of routers. Failed operations are counted and retried by the next iteration, so process deaths show up as throughput dips */
+WorkloadResult runWorkload (ShardSet, WorkloadSpec);
+
+}
+
+inline std::ostream& operator<< (std::ostream& out, const mongoDeploy::Histogram& x) {
+	out << "n=" << x.count() << " p50=" << x.percentile (0.5) << "us p99=" << x.percentile (0.99) << "us p999=" << x.percentile (0.999) << "us max=" << x.max() << "us";
+	return out;}
+
+inline std::ostream& operator<< (std::ostream& out, const mongoDeploy::WorkloadResult& x) {
+	out << "WorkloadResult " << (unsigned long) x.opsPerSec() << " ops/sec over " << x.seconds << "s, " << x.errors << " errors, longest dip " << x.longestDipMillis() << "ms" << std::endl
+		<< " insert " << x.inserts << std::endl
+		<< " read   " << x.reads << std::endl
+		<< " update " << x.updates;
+	return out;}